@@ -0,0 +1,47 @@
+/*
+ * Memory barriers for MIPS. See <membar.h>.
+ *
+ * MIPS32 only has the one barrier instruction, SYNC, which orders
+ * all loads and stores, so all the flavors come out the same. The
+ * asm is marked as clobbering memory so the compiler doesn't move
+ * loads and stores across it either.
+ */
+
+#ifndef _MIPS_MEMBAR_H_
+#define _MIPS_MEMBAR_H_
+
+#ifndef MEMBAR_INLINE
+#define MEMBAR_INLINE INLINE
+#endif
+
+MEMBAR_INLINE void membar_any_any(void);
+MEMBAR_INLINE void membar_load_load(void);
+MEMBAR_INLINE void membar_store_store(void);
+
+MEMBAR_INLINE
+void
+membar_any_any(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+MEMBAR_INLINE
+void
+membar_load_load(void)
+{
+	membar_any_any();
+}
+
+MEMBAR_INLINE
+void
+membar_store_store(void)
+{
+	membar_any_any();
+}
+
+#endif /* _MIPS_MEMBAR_H_ */
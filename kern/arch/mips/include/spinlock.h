@@ -43,6 +43,9 @@ typedef unsigned spinlock_data_t;
 void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+spinlock_data_t spinlock_data_cas(volatile spinlock_data_t *sd,
+				  spinlock_data_t oldval,
+				  spinlock_data_t newval);
 
 ////////////////////////////////////////////////////////////
 
@@ -93,5 +96,43 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_cas(volatile spinlock_data_t *sd, spinlock_data_t oldval,
+		  spinlock_data_t newval)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Compare-and-swap using LL/SC.
+	 *
+	 * Load the existing value into X. If it isn't OLDVAL, stop.
+	 * Otherwise try to store NEWVAL (via Y); if the SC fails
+	 * because someone else got at the word first, start over.
+	 *
+	 * Returns the value found, so the swap happened if and only
+	 * if the return value is OLDVAL.
+	 */
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *sd */
+		"bne %0, %3, 2f;"	/*   if (x != oldval) goto 2 */
+		" move %1, %4;"		/*   y = newval (delay slot) */
+		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) goto 1 */
+		" nop;"			/*   (delay slot) */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (sd), "r" (oldval), "r" (newval)
+		: "memory");
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -84,6 +84,9 @@
  */
 #define USERSTACK     USERSPACETOP
 
+/* Size of the user stack, in pages; both dumbvm and smartvm use this. */
+#define USERSTACKPAGES 12
+
 /*
  * Interface to the low-level module that looks after the amount of
  * physical memory we have.
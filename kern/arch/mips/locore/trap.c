@@ -119,6 +119,12 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 #if OPT_A3
   struct addrspace *as;
   struct proc *p = curproc;
+  // a fault in any thread kills the whole process (unless another
+  // thread is already taking it down, in which case just leave)
+  if (proc_uthread_killothers()) {
+    proc_uthread_checkexit();
+    panic("proc_uthread_checkexit returned\n");
+  }
   // set exit code in pid table
   pid_exit(sig);
 
@@ -132,7 +138,9 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+  if (!proc_vfork_release()) {
+    as_destroy(as);
+  }
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -231,6 +239,18 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+#if OPT_A3
+		if (!iskern && curproc->p_texiting) {
+			/*
+			 * Another thread is exiting the process and we
+			 * have to leave, which may sleep: put the
+			 * interrupt state back as for a syscall first.
+			 */
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
+#endif /* OPT_A3 */
 		goto done2;
 	}
 
@@ -351,6 +371,17 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_A3
+	/*
+	 * Leave now if another thread is exiting the process. Peek at
+	 * p_texiting first, so the usual return to user mode costs a
+	 * load and no lock.
+	 */
+	if (!iskern && curproc->p_texiting) {
+		proc_uthread_checkexit();
+	}
+#endif /* OPT_A3 */
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -28,6 +28,7 @@
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
@@ -38,6 +39,8 @@
 #include <syscall.h>
 #include <proc.h>
 #include <addrspace.h>
+#include <copyinout.h>
+#include <endian.h>
 
 
 /*
@@ -84,6 +87,10 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_A2
+	off_t retval64;		/* for calls that return 64 bits */
+	bool is64 = false;
+#endif /* OPT_A2 */
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -139,10 +146,131 @@ syscall(struct trapframe *tf)
     case SYS_fork:
       err = sys_fork(tf, (pid_t *) &retval);
       break;
+    case SYS_vfork:
+      err = sys_vfork(tf, (pid_t *) &retval);
+      break;
     case SYS_execv:
       err = sys_execv((const char *) tf->tf_a0, (char **) tf->tf_a1);
       break;
+    case SYS_spawn:
+      err = sys_spawn((const char *) tf->tf_a0, (char **) tf->tf_a1,
+              (pid_t *) &retval);
+      break;
+    case SYS_wait4:
+      err = sys_wait4((pid_t) tf->tf_a0, (userptr_t) tf->tf_a1,
+              (int) tf->tf_a2, (userptr_t) tf->tf_a3, (pid_t *) &retval);
+      break;
+    case SYS_open:
+      err = sys_open((userptr_t) tf->tf_a0, (int) tf->tf_a1,
+              (mode_t) tf->tf_a2, (int *) &retval);
+      break;
+    case SYS_close:
+      err = sys_close((int) tf->tf_a0);
+      break;
+    case SYS_pipe:
+      err = sys_pipe((userptr_t) tf->tf_a0, (int *) &retval);
+      break;
+    case SYS_read:
+      err = sys_read((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+              (unsigned int) tf->tf_a2, (int *) &retval);
+      break;
+    case SYS_readv:
+      err = sys_readv((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+              (int) tf->tf_a2, (int *) &retval);
+      break;
+    case SYS_writev:
+      err = sys_writev((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+              (int) tf->tf_a2, (int *) &retval);
+      break;
+    case SYS_pread:
+    case SYS_pwrite:
+    case SYS_preadv:
+    case SYS_pwritev:
+      {
+        // a3 is skipped; the 64-bit position is on the stack
+        off_t pos;
+
+        err = copyin((const_userptr_t) (tf->tf_sp + 16), &pos,
+                sizeof(off_t));
+        if (err) {
+            break;
+        }
+        switch (callno) {
+          case SYS_pread:
+            err = sys_pread((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+                    (unsigned int) tf->tf_a2, pos, (int *) &retval);
+            break;
+          case SYS_pwrite:
+            err = sys_pwrite((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+                    (unsigned int) tf->tf_a2, pos, (int *) &retval);
+            break;
+          case SYS_preadv:
+            err = sys_preadv((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+                    (int) tf->tf_a2, pos, (int *) &retval);
+            break;
+          default:
+            err = sys_pwritev((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+                    (int) tf->tf_a2, pos, (int *) &retval);
+            break;
+        }
+      }
+      break;
+    case SYS_lseek:
+      {
+        // pos is in a2/a3; whence is on the stack after the 4 slots
+        uint64_t pos;
+        int whence;
+
+        join32to64(tf->tf_a2, tf->tf_a3, &pos);
+        err = copyin((const_userptr_t) (tf->tf_sp + 16), &whence,
+                sizeof(int));
+        if (err == 0) {
+            err = sys_lseek((int) tf->tf_a0, (off_t) pos, whence,
+                    &retval64);
+            is64 = true;
+        }
+      }
+      break;
+    case SYS_dup2:
+      err = sys_dup2((int) tf->tf_a0, (int) tf->tf_a1, (int *) &retval);
+      break;
+    case SYS_poll:
+      err = sys_poll((userptr_t) tf->tf_a0, (unsigned) tf->tf_a1,
+              (int) tf->tf_a2, (int *) &retval);
+      break;
+    case SYS_select:
+      {
+        // the timeout is the fifth argument, on the stack
+        userptr_t utimeout;
+
+        err = copyin((const_userptr_t) (tf->tf_sp + 16), &utimeout,
+                sizeof(userptr_t));
+        if (err == 0) {
+            err = sys_select((int) tf->tf_a0, (userptr_t) tf->tf_a1,
+                    (userptr_t) tf->tf_a2, (userptr_t) tf->tf_a3,
+                    utimeout, (int *) &retval);
+        }
+      }
+      break;
+    case SYS_ioring_enter:
+      err = sys_ioring_enter((userptr_t) tf->tf_a0, (unsigned) tf->tf_a1,
+              (int *) &retval);
+      break;
 #endif /* OPT_A2 */
+#if OPT_A3
+    case SYS___threadfork:
+      err = sys___threadfork(tf, (userptr_t) tf->tf_a0,
+              (userptr_t) tf->tf_a1, (int *) &retval);
+      break;
+    case SYS_threadjoin:
+      err = sys_threadjoin((int) tf->tf_a0, (userptr_t) tf->tf_a1);
+      break;
+    case SYS_threadexit:
+      sys_threadexit((int) tf->tf_a0);
+      /* sys_threadexit does not return, execution should not get here */
+      panic("unexpected return from sys_threadexit");
+      break;
+#endif /* OPT_A3 */
  
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
@@ -164,6 +292,11 @@ syscall(struct trapframe *tf)
 		/* Success. */
 		tf->tf_v0 = retval;
 		tf->tf_a3 = 0;      /* signal no error */
+#if OPT_A2
+		if (is64) {
+			split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
+		}
+#endif /* OPT_A2 */
 	}
 	
 	/*
@@ -195,6 +328,11 @@ enter_forked_proces(void *tf_cp,
     // copy trapframe onto kernel stack
     struct trapframe tf_child = *(struct trapframe *) tf_cp; 
 
+#if OPT_A3
+    // keep the thread id (and so the user stack) we were forked from
+    curthread->t_tid = curproc->p_tfirst;
+#endif /* OPT_A3 */
+
     // set return value
     tf_child.tf_v0 = 0;
     // set status
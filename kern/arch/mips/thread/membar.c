@@ -0,0 +1,7 @@
+/*
+ * Make sure to build out-of-line versions of membar inline functions.
+ */
+#define MEMBAR_INLINE	/* empty */
+
+#include <types.h>
+#include <membar.h>
@@ -45,7 +45,7 @@
  */
 
 /* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
+#define DUMBVM_STACKPAGES    USERSTACKPAGES
 
 #if OPT_A3
 struct addrspace {
@@ -64,7 +64,7 @@ struct addrspace {
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_TICKET_INITIALIZER;
 
 void
 vm_bootstrap(void)
@@ -39,7 +39,17 @@
 #include <vm.h>
 #include "opt-A3.h"
 
-#define NUM_STACK_PAGES 12
+#define NUM_STACK_PAGES USERSTACKPAGES
+
+#if OPT_A3
+/*
+ * Stacks for additional user threads sit below the main stack, one
+ * slot per thread id, with an unmapped guard page between neighbours.
+ * Slot 0 is the main stack.
+ */
+#define THREADSTACK_TOP(slot) \
+    (USERSTACK - (slot) * (NUM_STACK_PAGES + 1) * PAGE_SIZE)
+#endif /* OPT_A3 */
 
 struct core_map_entry {
    bool available; 
@@ -67,13 +77,18 @@ struct addrspace {
     size_t stack_npages;
     int stack_permissions; 
 
+#if OPT_A3
+    /* user thread stacks, by slot; slot 0 is unused (see stack above) */
+    struct page_table_entry *threadstacks[PROC_MAXTHREADS];
+#endif /* OPT_A3 */
+
     bool load_elf_completed;
 };
 
 /*
  * Wrap rma_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_TICKET_INITIALIZER;
 static struct core_map_entry* core_map;
 static paddr_t firstpaddr, lastpaddr;
 static size_t ram_npages;
@@ -244,6 +259,19 @@ vm_fault(int faulttype, vaddr_t faultaddress)
         size_t i = (faultaddress - stack_vbase) / PAGE_SIZE;
 		paddr = as->stack[i].paddr;
 	}
+#if OPT_A3
+	else if (faultaddress >= THREADSTACK_TOP(PROC_MAXTHREADS) &&
+	         faultaddress < THREADSTACK_TOP(1)) {
+        unsigned slot = (USERSTACK - 1 - faultaddress) /
+            ((NUM_STACK_PAGES + 1) * PAGE_SIZE);
+        vaddr_t vbase = THREADSTACK_TOP(slot) - NUM_STACK_PAGES * PAGE_SIZE;
+        if (as->threadstacks[slot] == NULL || faultaddress < vbase) {
+            /* unused slot, or the guard page */
+            return EFAULT;
+        }
+		paddr = as->threadstacks[slot][(faultaddress - vbase) / PAGE_SIZE].paddr;
+	}
+#endif /* OPT_A3 */
 	else {
 		return EFAULT;
 	}
@@ -323,6 +351,12 @@ as_create(void)
     as->stack = NULL;
     as->stack_permissions = 0;
 
+#if OPT_A3
+    for (size_t i = 0; i < PROC_MAXTHREADS; ++i) {
+        as->threadstacks[i] = NULL;
+    }
+#endif /* OPT_A3 */
+
     as->load_elf_completed = false;
 
     return as;
@@ -350,6 +384,16 @@ as_destroy(struct addrspace *as)
             }
             kfree(as->stack);
         } 
+#if OPT_A3
+        for (size_t s = 1; s < PROC_MAXTHREADS; ++s) {
+            if (as->threadstacks[s] != NULL) {
+                for (size_t i = 0; i < NUM_STACK_PAGES; ++i) {
+                    freeppages(as->threadstacks[s][i].paddr);
+                }
+                kfree(as->threadstacks[s]);
+            }
+        }
+#endif /* OPT_A3 */
 	    kfree(as);
     }
 }
@@ -429,6 +473,63 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+#if OPT_A3
+/*
+ * Allocate and zero the pages for one user thread stack.
+ */
+static
+struct page_table_entry *
+as_alloc_threadstack(void)
+{
+    struct page_table_entry *pt;
+
+    pt = kmalloc(sizeof(struct page_table_entry) * NUM_STACK_PAGES);
+    if (pt == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < NUM_STACK_PAGES; ++i) {
+        pt[i].paddr = getppages(1);
+        if (pt[i].paddr == 0) {
+            while (i-- > 0) {
+                freeppages(pt[i].paddr);
+            }
+            kfree(pt);
+            return NULL;
+        }
+        as_zero_region(pt[i].paddr, 1);
+    }
+    return pt;
+}
+
+int
+as_define_threadstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr)
+{
+    KASSERT(as->stack != NULL);
+    KASSERT(slot > 0 && slot < PROC_MAXTHREADS);
+
+    /* don't let the stacks run into the data segment */
+    if (as->data_vbase + as->data_npages * PAGE_SIZE >
+        THREADSTACK_TOP(slot) - NUM_STACK_PAGES * PAGE_SIZE) {
+        return ENOMEM;
+    }
+
+    /*
+     * Stacks are kept until the address space goes away. Freeing one
+     * when its thread exits would need a TLB shootdown on every cpu
+     * running the process's other threads, which we can't do.
+     */
+    if (as->threadstacks[slot] == NULL) {
+        as->threadstacks[slot] = as_alloc_threadstack();
+        if (as->threadstacks[slot] == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    *stackptr = THREADSTACK_TOP(slot);
+    return 0;
+}
+#endif /* OPT_A3 */
+
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -541,6 +642,25 @@ as_copy(struct addrspace *old, struct addrspace **ret)
             (const void *)PADDR_TO_KVADDR(old->stack[i].paddr),
             PAGE_SIZE);
     }
+
+#if OPT_A3
+    /* the forking thread may be running on one of these */
+    for (size_t s = 1; s < PROC_MAXTHREADS; ++s) {
+        if (old->threadstacks[s] == NULL) {
+            continue;
+        }
+        new->threadstacks[s] = as_alloc_threadstack();
+        if (new->threadstacks[s] == NULL) {
+            as_destroy(new);
+            return ENOMEM;
+        }
+        for (size_t i = 0; i < NUM_STACK_PAGES; ++i) {
+            memmove((void *)PADDR_TO_KVADDR(new->threadstacks[s][i].paddr),
+                (const void *)PADDR_TO_KVADDR(old->threadstacks[s][i].paddr),
+                PAGE_SIZE);
+        }
+    }
+#endif /* OPT_A3 */
 	
 	*ret = new;
 	return 0;
@@ -194,6 +194,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 		
 	V(cs->cs_rsem);
+	pollhead_wakeup(&cs->cs_pollhead);
 }
 
 /*
@@ -360,6 +361,29 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Readable when a character has come in. (A read may still wait for
+ * the rest of the line, but only if asked for more than that.)
+ * Writing never waits for anyone else.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollent *pe, int *revents)
+{
+	struct con_softc *cs = dev->d_data;
+
+	*revents = events & POLLOUT;
+	if (events & POLLIN) {
+		if (pe != NULL) {
+			pollhead_add(&cs->cs_pollhead, pe);
+		}
+		if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+			*revents |= POLLIN;
+		}
+	}
+	return 0;
+}
+
 static
 int
 attach_console_to_vfs(struct con_softc *cs)
@@ -376,6 +400,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_poll = con_poll;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -441,6 +466,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollhead_init(&cs->cs_pollhead);
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -37,6 +37,8 @@
  * device, and are to be initialized by the attach routine.
  */
 
+#include <poll.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
 
 struct con_softc {
@@ -53,6 +55,7 @@ struct con_softc {
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	struct pollhead cs_pollhead;	/* woken when a char comes in */
 };
 
 /*
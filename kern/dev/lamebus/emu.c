@@ -51,6 +51,7 @@
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <poll.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -1092,6 +1093,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_mmap,
 	emufs_truncate,
 	emufs_uio_op_notdir, /* namefile */
+	vopnull_poll,
 
 	emufs_creat_notdir,
 	emufs_symlink_notdir,
@@ -1127,6 +1129,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_void_op_isdir,  /* mmap */
 	emufs_truncate_isdir,
 	emufs_namefile,
+	vopnull_poll,
 
 	emufs_creat,
 	emufs_symlink,
@@ -0,0 +1,427 @@
+/*
+ * SFS buffer cache.
+ *
+ * SFS_NBUF block buffers, shared by all mounted SFS volumes, found by
+ * (volume, block) through a small hash table. A buffer handed out by
+ * sfs_bread or sfs_bget is pinned until sfs_brelse; unpinned buffers
+ * sit on an LRU list, least recently used first, and a miss reuses
+ * the first of them. Buffers not holding anything go at the front.
+ *
+ * Writes are write-back: sfs_bdirty only marks the buffer, and it goes
+ * to disk when it's evicted or when sfs_bsync is called (from sfs_sync
+ * and sfs_fsync).
+ *
+ * Like the rest of SFS, all of this runs under the vfs biglock, which
+ * is what protects it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <sfs.h>
+
+#define SFS_NBUF	128
+#define SFS_NHASH	64		/* a power of two */
+
+struct sfs_buf {
+	struct sfs_fs *b_fs;		/* volume, or NULL if unused */
+	uint32_t b_block;
+	unsigned b_pincount;
+	bool b_valid;			/* b_data holds the block */
+	bool b_dirty;			/* b_data is newer than the disk */
+	struct sfs_buf *b_hashnext;
+	struct sfs_buf *b_lrunext;	/* on the LRU list if unpinned */
+	struct sfs_buf *b_lruprev;
+	char b_data[SFS_BLOCKSIZE];
+};
+
+static struct sfs_buf sfs_bufs[SFS_NBUF];
+static struct sfs_buf *sfs_bufhash[SFS_NHASH];
+static struct sfs_buf *sfs_lruhead, *sfs_lrutail;
+static bool sfs_bufinit;
+static unsigned sfs_ndirty;
+
+/*
+ * Counters for the "bc" menu command. Without the cache, every block
+ * read would have been a disk read and every block write a disk write.
+ */
+static struct {
+	unsigned bs_reads;		/* sfs_bread calls */
+	unsigned bs_hits;		/* ... that found the block cached */
+	unsigned bs_writes;		/* sfs_bdirty calls */
+	unsigned bs_diskreads;
+	unsigned bs_diskwrites;
+	unsigned bs_evictions;		/* of blocks still cached */
+} sfs_bstats;
+
+////////////////////////////////////////////////////////////
+// lists
+
+static
+unsigned
+sfs_bhash(struct sfs_fs *sfs, uint32_t block)
+{
+	return (((uintptr_t)sfs >> 4) ^ block) & (SFS_NHASH - 1);
+}
+
+static
+void
+sfs_lru_remove(struct sfs_buf *buf)
+{
+	if (buf->b_lruprev != NULL) {
+		buf->b_lruprev->b_lrunext = buf->b_lrunext;
+	}
+	else {
+		sfs_lruhead = buf->b_lrunext;
+	}
+	if (buf->b_lrunext != NULL) {
+		buf->b_lrunext->b_lruprev = buf->b_lruprev;
+	}
+	else {
+		sfs_lrutail = buf->b_lruprev;
+	}
+	buf->b_lrunext = buf->b_lruprev = NULL;
+}
+
+/* Put BUF at the back (most recently used) or front (to go next). */
+static
+void
+sfs_lru_add(struct sfs_buf *buf, bool front)
+{
+	if (front) {
+		buf->b_lruprev = NULL;
+		buf->b_lrunext = sfs_lruhead;
+		if (sfs_lruhead != NULL) {
+			sfs_lruhead->b_lruprev = buf;
+		}
+		else {
+			sfs_lrutail = buf;
+		}
+		sfs_lruhead = buf;
+	}
+	else {
+		buf->b_lrunext = NULL;
+		buf->b_lruprev = sfs_lrutail;
+		if (sfs_lrutail != NULL) {
+			sfs_lrutail->b_lrunext = buf;
+		}
+		else {
+			sfs_lruhead = buf;
+		}
+		sfs_lrutail = buf;
+	}
+}
+
+static
+void
+sfs_hash_remove(struct sfs_buf *buf)
+{
+	struct sfs_buf **pp;
+
+	pp = &sfs_bufhash[sfs_bhash(buf->b_fs, buf->b_block)];
+	while (*pp != buf) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = buf->b_hashnext;
+	buf->b_hashnext = NULL;
+}
+
+static
+void
+sfs_buf_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_NBUF; i++) {
+		sfs_bufs[i].b_fs = NULL;
+		sfs_bufs[i].b_pincount = 0;
+		sfs_bufs[i].b_valid = false;
+		sfs_bufs[i].b_dirty = false;
+		sfs_bufs[i].b_hashnext = NULL;
+		sfs_lru_add(&sfs_bufs[i], false);
+	}
+	sfs_bufinit = true;
+}
+
+////////////////////////////////////////////////////////////
+// disk I/O
+
+static
+int
+sfs_buf_io(struct sfs_buf *buf, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	if (rw == UIO_READ) {
+		sfs_bstats.bs_diskreads++;
+	}
+	else {
+		sfs_bstats.bs_diskwrites++;
+	}
+	SFSUIO(&iov, &ku, buf->b_data, buf->b_block, rw);
+	return sfs_rwblock(buf->b_fs, &ku);
+}
+
+/* Write BUF out if it's dirty. */
+static
+int
+sfs_buf_clean(struct sfs_buf *buf)
+{
+	int result;
+
+	if (!buf->b_dirty) {
+		return 0;
+	}
+	result = sfs_buf_io(buf, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+	buf->b_dirty = false;
+	KASSERT(sfs_ndirty > 0);
+	sfs_ndirty--;
+	return 0;
+}
+
+/* Stop caching BUF's block. It must be clean and unpinned. */
+static
+void
+sfs_buf_forget(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount == 0);
+	KASSERT(!buf->b_dirty);
+
+	if (buf->b_fs != NULL) {
+		sfs_hash_remove(buf);
+		buf->b_fs = NULL;
+	}
+	buf->b_valid = false;
+	sfs_lru_remove(buf);
+	sfs_lru_add(buf, true);
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+/*
+ * Find BLOCK of SFS, pinned, or a buffer for it, pinned and with
+ * b_valid false.
+ */
+static
+int
+sfs_bfind(struct sfs_fs *sfs, uint32_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *buf;
+	unsigned h;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	if (!sfs_bufinit) {
+		sfs_buf_bootstrap();
+	}
+
+	h = sfs_bhash(sfs, block);
+	for (buf = sfs_bufhash[h]; buf != NULL; buf = buf->b_hashnext) {
+		if (buf->b_fs == sfs && buf->b_block == block) {
+			break;
+		}
+	}
+
+	if (buf == NULL) {
+		/* the least recently used one that isn't pinned */
+		buf = sfs_lruhead;
+		if (buf == NULL) {
+			panic("sfs: all %u buffers are pinned\n", SFS_NBUF);
+		}
+		result = sfs_buf_clean(buf);
+		if (result) {
+			/* try someone else next time */
+			sfs_lru_remove(buf);
+			sfs_lru_add(buf, false);
+			return result;
+		}
+		if (buf->b_fs != NULL) {
+			sfs_bstats.bs_evictions++;
+		}
+		sfs_buf_forget(buf);
+
+		buf->b_fs = sfs;
+		buf->b_block = block;
+		buf->b_hashnext = sfs_bufhash[h];
+		sfs_bufhash[h] = buf;
+	}
+
+	if (buf->b_pincount++ == 0) {
+		sfs_lru_remove(buf);
+	}
+	*ret = buf;
+	return 0;
+}
+
+int
+sfs_bread(struct sfs_fs *sfs, uint32_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	result = sfs_bfind(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+
+	sfs_bstats.bs_reads++;
+	if (buf->b_valid) {
+		sfs_bstats.bs_hits++;
+	}
+	else {
+		result = sfs_buf_io(buf, UIO_READ);
+		if (result) {
+			sfs_brelse(buf);
+			return result;
+		}
+		buf->b_valid = true;
+	}
+
+	*ret = buf;
+	return 0;
+}
+
+int
+sfs_bget(struct sfs_fs *sfs, uint32_t block, struct sfs_buf **ret)
+{
+	return sfs_bfind(sfs, block, ret);
+}
+
+void *
+sfs_bdata(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount > 0);
+	return buf->b_data;
+}
+
+void
+sfs_bdirty(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount > 0);
+
+	sfs_bstats.bs_writes++;
+	buf->b_valid = true;
+	if (!buf->b_dirty) {
+		buf->b_dirty = true;
+		sfs_ndirty++;
+	}
+}
+
+void
+sfs_brelse(struct sfs_buf *buf)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(buf->b_pincount > 0);
+
+	if (--buf->b_pincount > 0) {
+		return;
+	}
+	if (!buf->b_valid) {
+		/* from sfs_bget, and never filled in; don't keep it */
+		sfs_hash_remove(buf);
+		buf->b_fs = NULL;
+		sfs_lru_add(buf, true);
+	}
+	else {
+		sfs_lru_add(buf, false);
+	}
+}
+
+/*
+ * Let go of a buffer that a failed copy may have half overwritten.
+ * If it was dirty it stays that way (the write went partly through);
+ * otherwise the disk still has the right contents, so forget ours.
+ */
+void
+sfs_babandon(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount > 0);
+
+	if (!buf->b_dirty) {
+		buf->b_valid = false;
+	}
+	sfs_brelse(buf);
+}
+
+int
+sfs_bsync(struct sfs_fs *sfs)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<SFS_NBUF && sfs_ndirty > 0; i++) {
+		if (sfs_bufs[i].b_fs == sfs) {
+			result = sfs_buf_clean(&sfs_bufs[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+sfs_bdrop(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return;
+	}
+	for (i=0; i<SFS_NBUF; i++) {
+		if (sfs_bufs[i].b_fs == sfs) {
+			sfs_buf_forget(&sfs_bufs[i]);
+		}
+	}
+}
+
+/*
+ * The "bc" menu command: print the counters, or with "reset", clear
+ * them. The uncached figures are what the disk would have seen
+ * without the cache.
+ */
+int
+sfs_bstats_cmd(int nargs, char **args)
+{
+	unsigned pct;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vfs_biglock_acquire();
+		bzero(&sfs_bstats, sizeof(sfs_bstats));
+		vfs_biglock_release();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: bc [reset]\n");
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+	pct = sfs_bstats.bs_reads == 0 ? 0 :
+		(unsigned)((uint64_t)sfs_bstats.bs_hits * 1000 /
+			   sfs_bstats.bs_reads);
+	kprintf("SFS buffer cache: %u buffers, %u dirty\n",
+		SFS_NBUF, sfs_ndirty);
+	kprintf("  block reads:  %u, %u hits (%u.%u%%)\n",
+		sfs_bstats.bs_reads, sfs_bstats.bs_hits, pct / 10, pct % 10);
+	kprintf("  block writes: %u\n", sfs_bstats.bs_writes);
+	kprintf("  disk reads:   %u (uncached: %u)\n",
+		sfs_bstats.bs_diskreads, sfs_bstats.bs_reads);
+	kprintf("  disk writes:  %u (uncached: %u)\n",
+		sfs_bstats.bs_diskwrites, sfs_bstats.bs_writes);
+	kprintf("  evictions:    %u\n", sfs_bstats.bs_evictions);
+	vfs_biglock_release();
+	return 0;
+}
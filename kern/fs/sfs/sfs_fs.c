@@ -39,6 +39,7 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -149,11 +150,13 @@ sfs_sync(struct fs *fs)
 	sfs = fs->fs_data;
 
 	/* Go over the array of loaded vnodes, syncing as we go. */
+	rwlock_acquire_read(sfs->sfs_vnlock);
 	num = vnodearray_num(sfs->sfs_vnodes);
 	for (i=0; i<num; i++) {
 		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
 		VOP_FSYNC(v);
 	}
+	rwlock_release_read(sfs->sfs_vnlock);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
@@ -175,6 +178,13 @@ sfs_sync(struct fs *fs)
 		sfs->sfs_superdirty = false;
 	}
 
+	/* All of the above only got as far as the buffer cache. */
+	result = sfs_bsync(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	vfs_biglock_release();
 	return 0;
 }
@@ -208,6 +218,7 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 	
@@ -221,9 +232,20 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* That should have left nothing in the buffer cache to write. */
+	result = sfs_bsync(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Once we start nuking stuff we can't fail. */
+	rwlock_destroy(sfs->sfs_vnlock);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
+
+	/* Forget our (clean) buffers */
+	sfs_bdrop(sfs);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -296,6 +318,13 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		vfs_biglock_release();
 		return ENOMEM;
 	}
+	sfs->sfs_vnlock = rwlock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
@@ -303,7 +332,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_bdrop(sfs);
 		kfree(sfs);
 		vfs_biglock_release();
 		return result;
@@ -316,7 +347,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_bdrop(sfs);
 		kfree(sfs);
 		vfs_biglock_release();
 		return EINVAL;
@@ -333,7 +366,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_bdrop(sfs);
 		kfree(sfs);
 		vfs_biglock_release();
 		return ENOMEM;
@@ -341,7 +376,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
+		rwlock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_bdrop(sfs);
 		kfree(sfs);
 		vfs_biglock_release();
 		return result;
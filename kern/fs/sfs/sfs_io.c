@@ -39,10 +39,15 @@
 //
 // Basic block-level I/O routines
 //
+// sfs_rwblock goes straight to the disk; sfs_rblock and
+// sfs_wblock go through the buffer cache (sfs_buf.c), so a
+// write may not reach the disk until the next sync.
+//
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device (and the sfs pointer itself, as the
+// cache key).
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -89,19 +94,30 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 int
 sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_bread(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, sfs_bdata(buf), SFS_BLOCKSIZE);
+	sfs_brelse(buf);
+	return 0;
 }
 
 int
 sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_bget(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_bdata(buf), data, SFS_BLOCKSIZE);
+	sfs_bdirty(buf);
+	sfs_brelse(buf);
+	return 0;
 }
@@ -42,6 +42,7 @@
 #include <uio.h>
 #include <synch.h>
 #include <vfs.h>
+#include <poll.h>
 #include <device.h>
 #include <sfs.h>
 
@@ -58,9 +59,18 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *buf;
+	int result;
+
+	/* no need to read it first */
+	result = sfs_bget(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_bdata(buf), SFS_BLOCKSIZE);
+	sfs_bdirty(buf);
+	sfs_brelse(buf);
+	return 0;
 }
 
 /* Write an on-disk inode structure back out to disk. */
@@ -146,22 +156,15 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *idptr;
 	uint32_t block;
 	uint32_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -247,38 +250,36 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		/* sfs_balloc zeroed it, in the cache, so loading it is free */
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Load the indirect block.
+	 */
+	result = sfs_bread(sfs, idblock, &idbuf);
+	if (result) {
+		return result;
 	}
+	idptr = sfs_bdata(idbuf);
 
 	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	block = idptr[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
+			sfs_brelse(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		idptr[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_bdirty(idbuf);
 	}
+	sfs_brelse(idbuf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -308,16 +309,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -339,38 +332,41 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * It reads as zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		return uiomovezeros(len, uio);
 	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Get the block from the buffer cache.
+	 */
+	result = sfs_bread(sfs, diskblock, &iobuf);
+	if (result) {
+		return result;
 	}
 
 	/*
 	 * Now perform the requested operation into/out of the buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = uiomove((char *)sfs_bdata(iobuf)+skipstart, len, uio);
 	if (result) {
+		if (uio->uio_rw == UIO_WRITE) {
+			sfs_babandon(iobuf);
+		}
+		else {
+			sfs_brelse(iobuf);
+		}
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the block is now dirty.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		sfs_bdirty(iobuf);
 	}
+	sfs_brelse(iobuf);
 
 	return 0;
 }
@@ -383,14 +379,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -413,31 +406,37 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
+	 * Go through the buffer cache, so the block stays coherent
+	 * with the cached copy. A write covers the whole block, so
+	 * there's no need to read it in first.
 	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-	
-	result = sfs_rwblock(sfs, uio);
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_bread(sfs, diskblock, &iobuf);
+	}
+	else {
+		result = sfs_bget(sfs, diskblock, &iobuf);
+	}
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update 
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	result = uiomove(sfs_bdata(iobuf), SFS_BLOCKSIZE, uio);
+	if (result) {
+		if (uio->uio_rw == UIO_WRITE) {
+			sfs_babandon(iobuf);
+		}
+		else {
+			sfs_brelse(iobuf);
+		}
+		return result;
+	}
 
-	return result;
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_bdirty(iobuf);
+	}
+	sfs_brelse(iobuf);
+	return 0;
 }
 
 /*
@@ -897,15 +896,18 @@ sfs_reclaim(struct vnode *v)
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. Holding the vnode table
+	 * for writing keeps sfs_loadvnode from finding it until it's
+	 * gone.
 	 */
+	rwlock_acquire_write(sfs->sfs_vnlock);
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
 		KASSERT(v->vn_refcount>1);
 		v->vn_refcount--;
 
+		rwlock_release_write(sfs->sfs_vnlock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -914,6 +916,7 @@ sfs_reclaim(struct vnode *v)
 	if (sv->sv_i.sfi_linkcount==0) {
 		result = VOP_TRUNCATE(&sv->sv_v, 0);
 		if (result) {
+			rwlock_release_write(sfs->sfs_vnlock);
 			vfs_biglock_release();
 			return result;
 		}
@@ -922,6 +925,7 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
+		rwlock_release_write(sfs->sfs_vnlock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -947,6 +951,7 @@ sfs_reclaim(struct vnode *v)
 		      sv->sv_ino);
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
+	rwlock_release_write(sfs->sfs_vnlock);
 
 	VOP_CLEANUP(&sv->sv_v);
 
@@ -1104,6 +1109,13 @@ sfs_fsync(struct vnode *v)
 
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
+	if (!result) {
+		/*
+		 * The cache doesn't know which file a block belongs
+		 * to, so this flushes the whole volume's dirty blocks.
+		 */
+		result = sfs_bsync(v->vn_fs->fs_data);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -1127,17 +1139,10 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *idptr;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -1147,7 +1152,7 @@ sfs_truncate(struct vnode *v, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
@@ -1177,41 +1182,44 @@ sfs_truncate(struct vnode *v, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+		result = sfs_bread(sfs, idblock, &idbuf);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
+		idptr = sfs_bdata(idbuf);
 		
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && idptr[j] != 0) {
+				sfs_bfree(sfs, idptr[j]);
+				idptr[j] = 0;
 				iddirty = 1;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (idptr[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
+		if (iddirty) {
+			/*
+			 * The indirect block is dirty. (Even if we're
+			 * about to free it: the cached copy has changed,
+			 * so it can't be left looking clean.)
+			 */
+			sfs_bdirty(idbuf);
+		}
+		sfs_brelse(idbuf);
+
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
 	}
 
 	/* Set the file size */
@@ -1594,6 +1602,7 @@ static const struct vnode_ops sfs_fileops = {
 	sfs_mmap,
 	sfs_truncate,
 	NOTDIR,  /* namefile */
+	vopnull_poll,
 
 	NOTDIR,  /* creat */
 	NOTDIR,  /* symlink */
@@ -1629,6 +1638,7 @@ static const struct vnode_ops sfs_dirops = {
 	ISDIR,   /* mmap */
 	ISDIR,   /* truncate */
 	sfs_namefile,
+	vopnull_poll,
 
 	sfs_creat,
 	UNIMP,   /* symlink */
@@ -1643,21 +1653,17 @@ static const struct vnode_ops sfs_dirops = {
 };
 
 /*
- * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * Look for inode INO in the vnodes table. The caller must hold
+ * sfs_vnlock, for reading or writing.
  */
 static
-int
-sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
-		 struct sfs_vnode **ret)
+struct sfs_vnode *
+sfs_findvnode(struct sfs_fs *sfs, uint32_t ino)
 {
 	struct vnode *v;
 	struct sfs_vnode *sv;
-	const struct vnode_ops *ops = NULL;
 	unsigned i, num;
-	int result;
 
-	/* Look in the vnodes table */
 	num = vnodearray_num(sfs->sfs_vnodes);
 
 	/* Linear search. Is this too slow? You decide. */
@@ -1672,16 +1678,42 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		}
 
 		if (sv->sv_ino==ino) {
-			/* Found */
+			return sv;
+		}
+	}
+	return NULL;
+}
 
-			/* May only be set when creating new objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+/*
+ * Function to load a inode into memory as a vnode, or dig up one
+ * that's already resident.
+ *
+ * The search runs with the vnodes table held for reading, so
+ * lookups don't serialize against each other; the table is only
+ * held for writing to add a newly loaded vnode.
+ */
+static
+int
+sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+		 struct sfs_vnode **ret)
+{
+	struct sfs_vnode *sv, *other;
+	const struct vnode_ops *ops = NULL;
+	int result;
 
-			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
-		}
+	/* Look in the vnodes table */
+	rwlock_acquire_read(sfs->sfs_vnlock);
+	sv = sfs_findvnode(sfs, ino);
+	if (sv != NULL) {
+		/* May only be set when creating new objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
+
+		VOP_INCREF(&sv->sv_v);
+		rwlock_release_read(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
+	rwlock_release_read(sfs->sfs_vnlock);
 
 	/* Didn't have it loaded; load it */
 
@@ -1743,8 +1775,23 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
 
-	/* Add it to our table */
+	/*
+	 * Add it to our table, unless someone else loaded the same
+	 * inode while we were reading it; then use theirs.
+	 */
+	rwlock_acquire_write(sfs->sfs_vnlock);
+	other = sfs_findvnode(sfs, ino);
+	if (other != NULL) {
+		KASSERT(forcetype==SFS_TYPE_INVAL);
+		VOP_INCREF(&other->sv_v);
+		rwlock_release_write(sfs->sfs_vnlock);
+		VOP_CLEANUP(&sv->sv_v);
+		kfree(sv);
+		*ret = other;
+		return 0;
+	}
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
+	rwlock_release_write(sfs->sfs_vnlock);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
 		kfree(sv);
@@ -96,6 +96,13 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_threadstack - set up the user stack for an additional
+ *                user-level thread in stack slot SLOT (1 or more; slot
+ *                0 is the ordinary stack). Hands back its initial stack
+ *                pointer. The stack stays in place until the address
+ *                space is destroyed and is reused if the slot is
+ *                defined again.
  */
 
 struct addrspace *as_create(void);
@@ -112,6 +119,10 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int               as_define_threadstack(struct addrspace *as, unsigned slot,
+                                        vaddr_t *initstackptr);
+#endif /* OPT_A3 */
 
 
 /*
@@ -119,9 +130,19 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *
+ *    elfcache_purge - drop the cached headers (and the vnode references
+ *               that go with them) of executables on FS. Called before
+ *               unmounting.
+ *
+ *    elfcache_cmd - the "ec" menu command.
  */
 
+struct fs;
+
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+void elfcache_purge(struct fs *fs);
+int elfcache_cmd(int nargs, char **args);
 
 
 #endif /* _ADDRSPACE_H_ */
@@ -59,7 +59,10 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Recycled threads, with stacks */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_wakeups_sent;	/* Threads we pushed on c_wakeups */
+	unsigned c_wakeup_retries;	/* CAS retries doing so */
 
 	/*
 	 * Accessed by other cpus.
@@ -69,6 +72,17 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * c_wakeups is a list (linked by t_wakeupnext, newest first)
+	 * of threads made runnable by other cpus. They push onto it
+	 * with compare-and-swap rather than taking c_runqueue_lock;
+	 * this cpu moves the whole list onto c_runqueue in
+	 * thread_switch.
+	 */
+	volatile spinlock_data_t c_wakeups;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
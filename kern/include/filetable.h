@@ -0,0 +1,77 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() makes: a vnode, the access mode, and the
+ * seek position. Descriptors are slots in a process's filetable that
+ * point at openfiles; dup2 and fork make more slots point at the same
+ * one, so they share the position, and the openfile (and the vnode)
+ * goes away when the last of them is closed.
+ *
+ * Looking up a descriptor is an array index. New descriptors are the
+ * lowest free slot, as POSIX requires; ft_lowfree remembers that no
+ * slot below it is free, so the search starts there.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+    struct vnode *of_vnode;
+    int of_flags;                   // O_ACCMODE bits and O_APPEND
+    struct lock *of_lock;           // held across I/O; protects of_offset
+    off_t of_offset;
+    struct spinlock of_reflock;
+    unsigned of_refcount;           // descriptors pointing here
+};
+
+struct filetable {
+    struct spinlock ft_lock;
+    unsigned ft_lowfree;            // no free descriptor below this
+    struct openfile *ft_files[OPEN_MAX];
+};
+
+/* Open PATH (which gets mangled) and make an openfile for it. */
+int openfile_open(char *path, int flags, mode_t mode,
+        struct openfile **ret);
+/* Make a pipe, and an openfile for each end. */
+int openfile_pipe(struct openfile **rret, struct openfile **wret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * Make a table with stdin, stdout and stderr on the console, or a
+ * copy of SRC sharing all its openfiles. NULL if out of memory.
+ */
+struct filetable *filetable_create_console(void);
+struct filetable *filetable_copy(struct filetable *src);
+
+/* Close everything and free FT. */
+void filetable_destroy(struct filetable *ft);
+
+/* Put OF in the lowest free slot; takes over the caller's reference. */
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+
+/* Get a new reference to the openfile for FD, or EBADF. */
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+
+/* Empty slot FD, handing its reference back in RET, or EBADF. */
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+/*
+ * Put OF in slot FD, taking over the caller's reference, and hand back
+ * whatever was there before (NULL if nothing) in OLD.
+ */
+int filetable_replace(struct filetable *ft, int fd, struct openfile *of,
+        struct openfile **old);
+
+#endif /* OPT_A2 */
+#endif /* _FILETABLE_H_ */
@@ -0,0 +1,74 @@
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Batched system calls (OS/161-specific).
+ *
+ * A process fills in submission entries in a struct ioring, in its
+ * own memory, and hands the lot to the kernel with one trap:
+ * ioring_enter(ring, n). The kernel runs up to N submitted entries
+ * in order, posts a completion for each, moves the heads and tails
+ * along, and returns how many it ran. Because entries run in order,
+ * an lseek followed by a read does what you'd expect.
+ *
+ * The counters run freely; entry I is at slot I % IORING_ENTRIES.
+ * The process owns ir_sqtail and ir_cqhead, the kernel the others.
+ * The kernel never runs more entries than there is completion room
+ * for, so a process that reaps completions between calls never
+ * loses one.
+ *
+ * An entry with IORING_F_STOP in sqe_flags ends the batch early if it
+ * fails, or if it's a read or write that moves less than sqe_len:
+ * ioring_enter returns after posting its completion, and the entries
+ * after it stay queued for the next call. That gives the process a
+ * chance to, say, finish a short write before the writes queued
+ * behind it run.
+ *
+ * The whole ring fits in one page.
+ */
+
+#include <kern/types.h>
+
+#define IORING_ENTRIES	64
+
+/* sqe_op */
+#define IORING_OP_NOP		0	/* does nothing; result 0 */
+#define IORING_OP_READ		1	/* read(fd, buf, len) */
+#define IORING_OP_WRITE		2	/* write(fd, buf, len) */
+#define IORING_OP_LSEEK		3	/* lseek(fd, off, whence) */
+#define IORING_OP_GETPID	4	/* getpid() */
+
+/* sqe_flags */
+#define IORING_F_STOP		1	/* stop here if this falls short */
+
+struct ioring_sqe {
+	int sqe_op;
+	int sqe_flags;
+	int sqe_fd;
+#ifdef _KERNEL
+	userptr_t sqe_buf;
+#else
+	void *sqe_buf;
+#endif
+	__u32 sqe_len;
+	int sqe_whence;
+	__u32 sqe_data;		/* passed through to the completion */
+	__off_t sqe_off;
+};
+
+struct ioring_cqe {
+	__u32 cqe_data;		/* from the submission */
+	int cqe_errno;		/* 0, or the error */
+	__off_t cqe_result;	/* what the call would have returned */
+};
+
+struct ioring {
+	volatile __u32 ir_sqhead;	/* next submission to run */
+	volatile __u32 ir_sqtail;	/* next submission slot to fill */
+	volatile __u32 ir_cqhead;	/* next completion to reap */
+	volatile __u32 ir_cqtail;	/* next completion slot to post */
+	struct ioring_sqe ir_sq[IORING_ENTRIES];
+	struct ioring_cqe ir_cq[IORING_ENTRIES];
+};
+
+#endif /* _KERN_IORING_H_ */
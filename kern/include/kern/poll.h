@@ -0,0 +1,56 @@
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll() and select().
+ */
+
+#include <kern/limits.h>
+
+/*
+ * One descriptor to poll. EVENTS says what to look for; the kernel
+ * fills in REVENTS with what it found. POLLERR, POLLHUP and POLLNVAL
+ * are reported whether asked for or not. A negative FD is skipped.
+ */
+struct pollfd {
+	int fd;
+	short events;
+	short revents;
+};
+
+#define POLLIN		0x0001	/* Can read without blocking */
+#define POLLPRI		0x0002	/* Urgent data (never happens) */
+#define POLLOUT		0x0004	/* Can write without blocking */
+#define POLLERR		0x0008	/* Error; for a pipe, no readers left */
+#define POLLHUP		0x0010	/* Hung up; for a pipe, no writers left */
+#define POLLNVAL	0x0020	/* FD is not open */
+
+#define POLLRDNORM	POLLIN
+#define POLLWRNORM	POLLOUT
+
+/*
+ * Descriptor sets for select(), one bit per descriptor.
+ */
+#define FD_SETSIZE	__OPEN_MAX
+#define __NFDBITS	32
+
+typedef struct {
+	unsigned int fds_bits[(FD_SETSIZE + __NFDBITS - 1) / __NFDBITS];
+} fd_set;
+
+#define FD_SET(fd, set) \
+	((set)->fds_bits[(fd) / __NFDBITS] |= 1U << ((fd) % __NFDBITS))
+#define FD_CLR(fd, set) \
+	((set)->fds_bits[(fd) / __NFDBITS] &= ~(1U << ((fd) % __NFDBITS)))
+#define FD_ISSET(fd, set) \
+	(((set)->fds_bits[(fd) / __NFDBITS] & (1U << ((fd) % __NFDBITS))) != 0)
+#define FD_ZERO(set) \
+	do { \
+		unsigned __i; \
+		for (__i = 0; __i < sizeof((set)->fds_bits) / \
+			     sizeof((set)->fds_bits[0]); __i++) { \
+			(set)->fds_bits[__i] = 0; \
+		} \
+	} while (0)
+
+#endif /* _KERN_POLL_H_ */
@@ -85,7 +85,7 @@
 #define SYS_sigreturn    32
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
-//#define SYS_wait4      34
+#define SYS_wait4        34
 //#define SYS_getrusage  35
 //                              (resource limits)
 //#define SYS_getrlimit  36
@@ -109,13 +109,13 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
-//#define SYS_preadv     53
+#define SYS_readv        52
+#define SYS_preadv       53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
-//#define SYS_pwritev    58
+#define SYS_writev       57
+#define SYS_pwritev      58
 #define SYS_lseek        59
 #define SYS_flock        60
 #define SYS_ftruncate    61
@@ -197,6 +197,17 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- User-level threads --
+#define SYS___threadfork 121
+#define SYS_threadjoin   122
+#define SYS_threadexit   123
+
+//                              -- Process creation (OS/161-specific) --
+#define SYS_spawn        124
+
+//                              -- Batched calls (OS/161-specific) --
+#define SYS_ioring_enter 125
+
 /*CALLEND*/
 
 
@@ -0,0 +1,57 @@
+/*
+ * Lock order validator.
+ *
+ * When the kernel is configured with "options lockdep", every sleep
+ * lock and rwlock belongs to a lock class, named after the lock (so
+ * all the locks called "p_lock" are one class). Each thread keeps a
+ * stack of the classes it holds, and whenever it goes for a lock
+ * while holding others we note that the held classes come before the
+ * new one. Those notes make a graph; if a new edge closes a cycle,
+ * two code paths take the same locks in opposite orders and can
+ * deadlock, whether or not they happened to this time. That gets
+ * reported, with the place each class was first created, as soon as
+ * the second order is seen.
+ *
+ * Each problem is reported once. Checking only happens the first time
+ * a given pair of classes is seen nested, so after warming up the
+ * cost is a scan of the thread's held-lock stack.
+ *
+ * Without the option the hooks compile to nothing.
+ */
+
+#ifndef _LOCKDEP_H_
+#define _LOCKDEP_H_
+
+#include "opt-lockdep.h"
+
+struct lock;
+struct rwlock;
+
+/* Most locks one thread can hold at once and still be checked. */
+#define LOCKDEP_MAXHELD		16
+
+#if OPT_LOCKDEP
+
+/* Called by the lock code. SITE is the caller of the create function. */
+void lockdep_lock_init(struct lock *lk, const void *site);
+void lockdep_lock_acquire(struct lock *lk);
+void lockdep_lock_release(struct lock *lk);
+void lockdep_rwlock_init(struct rwlock *rw, const void *site);
+void lockdep_rwlock_acquire(struct rwlock *rw);
+void lockdep_rwlock_release(struct rwlock *rw);
+
+/* Number of problems reported so far. */
+unsigned lockdep_reports(void);
+
+#else
+
+#define lockdep_lock_init(lk, site)	((void)0)
+#define lockdep_lock_acquire(lk)	((void)0)
+#define lockdep_lock_release(lk)	((void)0)
+#define lockdep_rwlock_init(rw, site)	((void)0)
+#define lockdep_rwlock_acquire(rw)	((void)0)
+#define lockdep_rwlock_release(rw)	((void)0)
+
+#endif /* OPT_LOCKDEP */
+
+#endif /* _LOCKDEP_H_ */
@@ -0,0 +1,60 @@
+/*
+ * Lock contention statistics.
+ *
+ * When the kernel is configured with "options lockstat", spinlocks and
+ * sleep locks record, for every acquisition:
+ *
+ *    - whether the lock was already held when we asked for it
+ *      (contended);
+ *    - how long we waited to get it, for contended acquisitions;
+ *    - how long it was held.
+ *
+ * Sleep locks are grouped by name, so all the locks made with the
+ * same name are counted together. Spinlocks have no names; they are
+ * grouped by the address of the code that called spinlock_acquire.
+ * Times are in nanoseconds, from gettime().
+ *
+ * Recording starts off; use the "lockstat" menu command to turn it on
+ * and off and to print the most contended locks.
+ *
+ * Without the option the hooks compile to nothing and the fields they
+ * need are not in struct spinlock or struct lock.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+#include "opt-lockstat.h"
+
+struct spinlock;
+struct lock;
+
+#if OPT_LOCKSTAT
+
+/*
+ * Called by the lock code. WAITSTART is the time we first found the
+ * lock held, from lockstat_now(), or 0 if it was free. lockstat_now
+ * returns 0 while recording is off. The acquired and released hooks
+ * must be called with interrupts off.
+ */
+uint64_t lockstat_now(void);
+void lockstat_spin_acquired(struct spinlock *lk, const void *site,
+			    uint64_t waitstart);
+void lockstat_spin_released(struct spinlock *lk);
+void lockstat_lock_acquired(struct lock *lk, uint64_t waitstart);
+void lockstat_lock_released(struct lock *lk);
+
+/* The "lockstat" menu command. */
+int lockstat_cmd(int nargs, char **args);
+
+#else
+
+#define lockstat_now()					((uint64_t)0)
+#define lockstat_spin_acquired(lk, site, waitstart)	((void)(waitstart))
+#define lockstat_spin_released(lk)			((void)0)
+#define lockstat_lock_acquired(lk, waitstart)		((void)(waitstart))
+#define lockstat_lock_released(lk)			((void)0)
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
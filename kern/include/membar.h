@@ -0,0 +1,22 @@
+/*
+ * Memory barriers.
+ *
+ * membar_load_load	earlier loads finish before later loads
+ * membar_store_store	earlier stores finish before later stores
+ * membar_any_any	all earlier accesses finish before any later one
+ *
+ * These also keep the compiler from reordering across them. Plain
+ * aligned word loads and stores are atomic by themselves; barriers
+ * are only needed when the order of several of them matters to
+ * another cpu, as in seqlocks.
+ */
+
+#ifndef _MEMBAR_H_
+#define _MEMBAR_H_
+
+#include <cdefs.h>
+
+/* Get the machine-dependent bits. */
+#include <machine/membar.h>
+
+#endif /* _MEMBAR_H_ */
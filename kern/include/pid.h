@@ -39,16 +39,20 @@
 struct pid_stat {
     pid_t p_parent_pid;
     int p_exitcode;
+    // where this process waits for its children; made on first use
     struct cv *p_cv;
-    
+    // children of this process, linked through the child's entries
+    pid_t p_first_child;
+    pid_t p_next_sibling;
+    pid_t p_prev_sibling;
 };
 
 void pid_bootstrap(void);
 void pid_assign_kern(struct proc *proc_kern);
 void pid_assign_next(struct proc *proc_child);
-int pid_wait(pid_t pid, int *exitstatus);
+int pid_wait(pid_t pid, int options, pid_t *pid_reaped, int *exitstatus);
 void pid_exit(int exitcode);
-void pid_fail(void);
+void pid_fail(struct proc *proc_child);
 
 
 #endif /* OPT_A2 */
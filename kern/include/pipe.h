@@ -0,0 +1,26 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Anonymous pipes.
+ *
+ * pipe_create makes a pipe and returns a vnode for each end, already
+ * opened (one reference, open count one), so both are given up with
+ * vfs_close. Reading from RVN returns 0 once the write end has been
+ * closed and everything written has been read; writing to WVN fails
+ * with EPIPE once the read end has been closed.
+ *
+ * Up to PIPE_SIZE bytes (a page) are buffered. Writers take turns, so
+ * a write is never interleaved with another one, whatever its size;
+ * that's more than the PIPE_BUF bytes POSIX asks for.
+ */
+
+#include <vm.h>
+
+struct vnode;
+
+#define PIPE_SIZE	PAGE_SIZE
+
+int pipe_create(struct vnode **rvn, struct vnode **wvn);
+
+#endif /* _PIPE_H_ */
@@ -0,0 +1,86 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification, for poll() and select().
+ *
+ * Anything that can become readable or writable (a pipe end, the
+ * console) keeps a pollhead. A poll call makes a poller with one
+ * pollent per descriptor and passes each to vop_poll, which reports
+ * what's ready now and, if nothing is, hangs the pollent on the
+ * object's pollhead with pollhead_add. When the object's state
+ * changes it calls pollhead_wakeup, which marks the pollents on it
+ * as fired, puts them on their poller's ready list and wakes the
+ * poller. So a poller that wakes up looks again only at what fired,
+ * not at every descriptor it was given.
+ *
+ * Wakeups can be spurious: a fired pollent means "look again", not
+ * "ready". A pollhead_wakeup that comes between the pollhead_add and
+ * the check of the object's state is not lost, since pollhead_add
+ * happens first and the waker looks at the list after changing the
+ * state (both with a barrier in between).
+ *
+ * The object must outlive the poller's pollents on it; poll keeps a
+ * reference to each file until poller_destroy has taken them off.
+ */
+
+#include <kern/poll.h>
+#include <spinlock.h>
+
+struct poller;
+
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollent *ph_first;	/* waiting pollents */
+};
+
+struct pollent {
+	struct pollhead *pe_head;	/* what we're on, or NULL */
+	struct pollent *pe_next;	/* on pe_head */
+	struct pollent *pe_prev;
+	struct poller *pe_poller;
+	struct pollent *pe_readynext;	/* on the poller's ready list */
+	bool pe_fired;			/* on the ready list */
+	unsigned pe_index;		/* which descriptor */
+};
+
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+
+/* Wait on PH. For vop_poll, before it checks its state. */
+void pollhead_add(struct pollhead *ph, struct pollent *pe);
+
+/* PH's object changed state; for after the change is visible. */
+void pollhead_wakeup(struct pollhead *ph);
+
+/* A poller with NENTS pollents, numbered from 0. NULL if no memory. */
+struct poller *poller_create(unsigned nents);
+struct pollent *poller_ent(struct poller *pl, unsigned index);
+
+/*
+ * Give up waiting TIMEOUT_MS milliseconds from now: at once if it's
+ * zero, never if it's negative (the default). Call at most once.
+ */
+void poller_settimeout(struct poller *pl, int timeout_ms);
+
+/*
+ * Wait until a pollent fires or the timeout passes. Returns 0 if
+ * something fired, else ETIMEDOUT.
+ */
+int poller_wait(struct poller *pl);
+
+/* Take a fired pollent's index off the ready list; false if none. */
+bool poller_next(struct poller *pl, unsigned *index);
+
+/* Take all the pollents off their pollheads and free PL. */
+void poller_destroy(struct poller *pl);
+
+/* Called from hardclock, to time out pollers. */
+void poll_hardclock(void);
+
+/* vop_poll for things that are always readable and writable. */
+struct vnode;
+int vopnull_poll(struct vnode *v, int events, struct pollent *pe,
+		 int *revents);
+
+#endif /* _POLL_H_ */
@@ -37,15 +37,36 @@
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 
 struct addrspace;
 struct vnode;
+#if OPT_A2
+struct filetable;
+#endif /* OPT_A2 */
 #ifdef UW
 struct semaphore;
 #endif // UW
+#if OPT_A3
+struct lock;
+struct cv;
+
+/*
+ * User-level threads. Each user thread in a process has a thread id,
+ * which is also the slot its user stack lives in (see
+ * as_define_threadstack). The thread a process starts with normally
+ * has id 0 and runs on the ordinary user stack.
+ */
+#define PROC_MAXTHREADS 16
+
+/* Thread id states */
+#define PROC_TFREE      0	/* id not in use */
+#define PROC_TRUNNING   1	/* thread is alive */
+#define PROC_TZOMBIE    2	/* thread has exited, not yet joined */
+#endif /* OPT_A3 */
 
 /*
  * Process structure.
@@ -61,7 +82,7 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-#ifdef UW
+#if defined(UW) && !OPT_A2
   /* a vnode to refer to the console device */
   /* this is a quick-and-dirty way to get console writes working */
   /* you will probably need to change this when implementing file-related
@@ -74,8 +95,23 @@ struct proc {
 
 #if OPT_A2
     pid_t p_pid;
+    /* open files; NULL for the kernel and once the process has exited */
+    struct filetable *p_files;
+    /* vfork child: parent waits here while we run in its address space */
+    struct semaphore *p_vfork_wait;
 #endif /* OPT_A2 */
 
+#if OPT_A3
+    /* user-level threads; protected by p_tlock */
+    struct lock *p_tlock;
+    struct cv *p_tcv;               /* signalled when a thread goes away */
+    unsigned p_tlive;               /* user threads still attached */
+    unsigned p_tfirst;              /* id of the thread we started with */
+    volatile bool p_texiting;       /* other threads must leave */
+    int p_tstate[PROC_MAXTHREADS];  /* PROC_TFREE etc. */
+    int p_texitval[PROC_MAXTHREADS];
+#endif /* OPT_A3 */
+
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -89,8 +125,8 @@ extern struct semaphore *no_proc_sem;
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
-/* Create a fresh process for use by runprogram(). */
-struct proc *proc_create_runprogram(const char *name);
+/* Create a fresh process for use by runprogram(), with first thread TID. */
+struct proc *proc_create_runprogram(const char *name, unsigned tid);
 
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
@@ -107,5 +143,20 @@ struct addrspace *curproc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
+#if OPT_A2
+/* A vfork child is done with its parent's address space. */
+bool proc_vfork_release(void);
+#endif /* OPT_A2 */
+
+#if OPT_A3
+/* User-level thread bookkeeping (see proc.c for details). */
+int proc_uthread_alloc(struct proc *proc, unsigned *tid);
+void proc_uthread_free(struct proc *proc, unsigned tid);
+int proc_uthread_join(unsigned tid, int *exitval);
+bool proc_uthread_exit(int exitval);
+int proc_uthread_killothers(void);
+void proc_uthread_checkexit(void);
+#endif /* OPT_A3 */
+
 
 #endif /* _PROC_H_ */
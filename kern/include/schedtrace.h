@@ -0,0 +1,47 @@
+/*
+ * Scheduler tracing.
+ *
+ * When the kernel is configured with "options schedtrace", the
+ * thread system records, per cpu:
+ *
+ *    - how long each thread waited between being made runnable and
+ *      actually getting the cpu (wakeup-to-run latency);
+ *    - samples of the run queue length, taken every hardclock;
+ *    - how many context switches were voluntary (sleeping, exiting,
+ *      or explicitly yielding) and how many were involuntary
+ *      (preemption from the timer interrupt).
+ *
+ * Each cpu keeps histograms of these and a ring buffer of the most
+ * recent switches. Tracing starts off; use the "st" menu command to
+ * turn it on and off and to print the results.
+ *
+ * Without the option the hooks compile to nothing.
+ */
+
+#ifndef _SCHEDTRACE_H_
+#define _SCHEDTRACE_H_
+
+#include "opt-schedtrace.h"
+
+struct thread;
+
+#if OPT_SCHEDTRACE
+
+/* Called by the thread system. */
+void schedtrace_runnable(struct thread *t);
+void schedtrace_switch(struct thread *cur, struct thread *next,
+		       bool voluntary, unsigned rqlen);
+void schedtrace_sample(unsigned rqlen);
+
+/* The "st" menu command. */
+int schedtrace_cmd(int nargs, char **args);
+
+#else
+
+#define schedtrace_runnable(t)				((void)0)
+#define schedtrace_switch(cur, next, voluntary, rqlen)	((void)0)
+#define schedtrace_sample(rqlen)			((void)0)
+
+#endif /* OPT_SCHEDTRACE */
+
+#endif /* _SCHEDTRACE_H_ */
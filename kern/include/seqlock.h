@@ -0,0 +1,109 @@
+/*
+ * Sequence locks.
+ *
+ * For data that is read often and written rarely, where readers
+ * shouldn't have to take a lock at all. Writers take the seqlock's
+ * spinlock and bump the sequence number before and after changing the
+ * data, so it's odd while a write is in progress. Readers note the
+ * sequence number, copy the data, and try again if the number changed
+ * (or was odd) meanwhile:
+ *
+ *	do {
+ *		seq = seqlock_read_begin(&sl);
+ *		copy = data;
+ *	} while (seqlock_read_retry(&sl, seq));
+ *
+ * Readers never block writers and never write shared memory, so they
+ * don't bounce cache lines between cpus. The price is that a reader
+ * may see torn data on the way and has to throw it away; so readers
+ * must only copy, never follow pointers or act on what they read
+ * until the retry check passes.
+ *
+ * Writers run with interrupts off (they hold a spinlock), so a
+ * reader can't interrupt a writer on the same cpu and spin forever.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <spinlock.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	struct spinlock sl_lock;	/* Serializes writers. */
+	volatile unsigned sl_seq;	/* Odd while a write is going on. */
+};
+
+#define SEQLOCK_INITIALIZER	{ SPINLOCK_INITIALIZER, 0 }
+
+/*
+ * Seqlock functions.
+ *
+ * init		Initialize the contents of a seqlock.
+ * cleanup	Opposite of init. No write may be in progress.
+ *
+ * write_begin	Start changing the data. Also disables interrupts.
+ * write_end	Done changing the data.
+ *
+ * read_begin	Start reading; returns the sequence number to check.
+ * read_retry	True if the data read since read_begin may be torn.
+ */
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_cleanup(struct seqlock *sl);
+
+SEQLOCK_INLINE void seqlock_write_begin(struct seqlock *sl);
+SEQLOCK_INLINE void seqlock_write_end(struct seqlock *sl);
+SEQLOCK_INLINE unsigned seqlock_read_begin(struct seqlock *sl);
+SEQLOCK_INLINE bool seqlock_read_retry(struct seqlock *sl, unsigned seq);
+
+////////////////////////////////////////////////////////////
+
+SEQLOCK_INLINE
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	spinlock_acquire(&sl->sl_lock);
+	sl->sl_seq++;
+	/* readers must see the odd number before any of the new data */
+	membar_store_store();
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	/* ...and all the new data before the even number */
+	membar_store_store();
+	sl->sl_seq++;
+	spinlock_release(&sl->sl_lock);
+}
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(struct seqlock *sl)
+{
+	unsigned seq;
+
+	/* wait out a write in progress on another cpu */
+	while ((seq = sl->sl_seq) & 1) {
+		/* spin */
+	}
+	membar_load_load();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(struct seqlock *sl, unsigned seq)
+{
+	membar_load_load();
+	return sl->sl_seq != seq;
+}
+
+#endif /* _SEQLOCK_H_ */
@@ -61,6 +61,7 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct rwlock *sfs_vnlock;      /* protects sfs_vnodes */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
 };
@@ -84,6 +85,25 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/*
+ * Buffer cache (sfs_buf.c). sfs_bread and sfs_bget return the block's
+ * buffer pinned, to be let go with sfs_brelse; sfs_bget doesn't read
+ * it in, for callers about to overwrite the whole block. sfs_bdirty
+ * marks a buffer for writing back; sfs_babandon lets go of one a
+ * failed copy may have scribbled on. sfs_bsync writes back a volume's
+ * dirty buffers; sfs_bdrop forgets its (clean) buffers at unmount.
+ */
+struct sfs_buf;
+int sfs_bread(struct sfs_fs *sfs, uint32_t block, struct sfs_buf **ret);
+int sfs_bget(struct sfs_fs *sfs, uint32_t block, struct sfs_buf **ret);
+void *sfs_bdata(struct sfs_buf *buf);
+void sfs_bdirty(struct sfs_buf *buf);
+void sfs_brelse(struct sfs_buf *buf);
+void sfs_babandon(struct sfs_buf *buf);
+int sfs_bsync(struct sfs_fs *sfs);
+void sfs_bdrop(struct sfs_fs *sfs);
+int sfs_bstats_cmd(int nargs, char **args);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
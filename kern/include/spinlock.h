@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -53,21 +54,45 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * A ticket spinlock hands the lock out in the order it was asked for:
+ * lk_lock is then the next ticket to give out and lk_serving is the
+ * ticket that currently holds the lock. Ordinary spinlocks are
+ * cheaper when uncontended, but under contention every waiter races
+ * for the lock word and some CPUs can lose over and over; ticket
+ * locks are meant for hot global locks where that matters.
  */
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	bool lk_ticket;			/* FIFO ticket lock? */
+	volatile spinlock_data_t lk_serving; /* Ticket now holding the lock. */
+#if OPT_LOCKSTAT
+	struct lockstat_rec *lk_statrec; /* Stats for the current holder. */
+	uint64_t lk_stattime;		/* When it was acquired. */
+#endif
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_STAT_INITIALIZER	, NULL, 0
+#else
+#define SPINLOCK_STAT_INITIALIZER
+#endif
+#define SPINLOCK_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, NULL, false, \
+	  SPINLOCK_DATA_INITIALIZER SPINLOCK_STAT_INITIALIZER }
+#define SPINLOCK_TICKET_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, NULL, true, \
+	  SPINLOCK_DATA_INITIALIZER SPINLOCK_STAT_INITIALIZER }
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +102,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -36,6 +36,9 @@
 
 
 #include <spinlock.h>
+#include "opt-lockdep.h"
+
+struct cpu;
 
 /*
  * Dijkstra-style semaphore.
@@ -48,6 +51,8 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+        bool sem_fifo;
+        unsigned sem_waiters;   /* FIFO sleepers not yet handed a count */
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -58,9 +63,15 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * sem_setfifo makes the semaphore strictly FIFO: P never gets ahead
+ * of a thread already sleeping, and V hands its count directly to
+ * the longest sleeper instead of waking it to compete for it. Call it
+ * right after sem_create, before anyone uses the semaphore.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+void sem_setfifo(struct semaphore *);
 
 
 /*
@@ -71,12 +82,28 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive by default: a thread that finds the lock held by
+ * a thread running on another cpu spins for a while before sleeping,
+ * since the holder will probably let go soon. lk_cpu is the cpu the
+ * holder was on when it got the lock.
  */
 struct lock {
         char *lk_name;
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         volatile struct thread *lk_thread; 
+        struct cpu *volatile lk_cpu;
+        bool lk_adaptive;
+        bool lk_fifo;
+        unsigned lk_waiters;    /* FIFO sleepers */
+#if OPT_LOCKSTAT
+        struct lockstat_rec *lk_statrec;
+        uint64_t lk_stattime;
+#endif
+#if OPT_LOCKDEP
+        int lk_depclass;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -90,11 +117,18 @@ void lock_acquire(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
+ *    lock_setadaptive - Turn spinning before sleeping on or off.
+ *    lock_setfifo - Make the lock strictly FIFO: lock_release hands
+ *                   it straight to the longest waiter, and nobody
+ *                   can take it ahead of a waiter. FIFO locks don't
+ *                   spin. Call before the lock is first used.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+void lock_setadaptive(struct lock *, bool);
+void lock_setfifo(struct lock *);
 void lock_destroy(struct lock *);
 
 
@@ -138,4 +172,82 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Keyed condition variable.
+ *
+ * Like a CV, but with a separate wait queue for each of NKEYS keys.
+ * The key names the condition a waiter is waiting for (a direction,
+ * a bowl, ...), so that when something changes the code can wake just
+ * the waiters whose condition might now hold instead of broadcasting
+ * to everybody and having most of them go straight back to sleep.
+ *
+ * Operations are as for CVs, with keys 0 .. NKEYS-1:
+ *    kcv_wait         - Wait on the queue for KEY.
+ *    kcv_signal       - Wake one thread waiting on KEY.
+ *    kcv_broadcast    - Wake every thread waiting on KEY.
+ *    kcv_broadcastall - Wake every thread on every key, like cv_broadcast.
+ */
+struct kcv {
+        char *kcv_name;
+        unsigned kcv_nkeys;
+        struct wchan **kcv_wchans;      /* one per key */
+};
+
+struct kcv *kcv_create(const char *name, unsigned nkeys);
+void kcv_destroy(struct kcv *);
+
+void kcv_wait(struct kcv *kcv, struct lock *lock, unsigned key);
+void kcv_signal(struct kcv *kcv, struct lock *lock, unsigned key);
+void kcv_broadcast(struct kcv *kcv, struct lock *lock, unsigned key);
+void kcv_broadcastall(struct kcv *kcv, struct lock *lock);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers have preference: once a writer is waiting, new readers
+ * wait behind it, so a steady stream of readers can't starve writers.
+ * When a writer releases the lock it hands off to the next writer if
+ * there is one, and otherwise lets in all the waiting readers.
+ *
+ * The lock is not recursive, for readers or writers.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+
+struct rwlock {
+        char *rw_name;
+        struct wchan *rw_readwchan;     /* readers wait here */
+        struct wchan *rw_writewchan;    /* writers wait here */
+        struct spinlock rw_lock;
+        unsigned rw_readers;            /* readers holding the lock */
+        unsigned rw_writerswaiting;     /* writers waiting for it */
+        struct thread *rw_writer;       /* writer holding it, if any */
+#if OPT_LOCKDEP
+        int rw_depclass;
+#endif
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing. (There's no equivalent for
+ *                   readers, which aren't tracked individually.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -31,6 +31,7 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -72,7 +73,35 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 #endif // UW
 #if OPT_A2
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(const char *program, char **uargs);
+int sys_spawn(const char *program, char **uargs, pid_t *retval);
+int sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+        pid_t *retval);
+int sys_open(userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_close(int fd);
+int sys_pipe(userptr_t ufds, int *retval);
+int sys_read(int fd, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_pread(int fd, userptr_t ubuf, unsigned int nbytes, off_t pos,
+        int *retval);
+int sys_pwrite(int fd, userptr_t ubuf, unsigned int nbytes, off_t pos,
+        int *retval);
+int sys_readv(int fd, userptr_t uiov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t uiov, int iovcnt, int *retval);
+int sys_preadv(int fd, userptr_t uiov, int iovcnt, off_t pos, int *retval);
+int sys_pwritev(int fd, userptr_t uiov, int iovcnt, off_t pos, int *retval);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval);
+int sys_select(int nfds, userptr_t ureadfds, userptr_t uwritefds,
+        userptr_t uexceptfds, userptr_t utimeout, int *retval);
+int sys_ioring_enter(userptr_t uring, unsigned tosubmit, int *retval);
 #endif /* OPT_A2 */
+#if OPT_A3
+int sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg,
+        int *retval);
+int sys_threadjoin(int tid, userptr_t status);
+void sys_threadexit(int exitval);
+#endif /* OPT_A3 */
 
 #endif /* _SYSCALL_H_ */
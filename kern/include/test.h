@@ -60,7 +60,15 @@ int threadtest2(int, char **);
 int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
+int lockbench(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int spinbench(int, char **);
+int lockdeptest(int, char **);
+
+/* thread system benchmarks */
+int forkbench(int, char **);
+int wakeupbench(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
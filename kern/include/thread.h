@@ -39,6 +39,9 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <lockdep.h>
+#include "opt-schedtrace.h"
+#include "opt-A3.h"
 
 struct cpu;
 
@@ -55,6 +58,9 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are kept in the thread itself, not kmalloc'd */
+#define THREAD_NAMEBUF_SIZE 32
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -73,12 +79,14 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+	char t_namebuf[THREAD_NAMEBUF_SIZE]; /* Storage for short t_name */
 
 	/*
 	 * Thread subsystem internal fields.
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct thread *t_wakeupnext;	/* Link for cpu remote wakeup list */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
@@ -101,11 +109,28 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+#if OPT_SCHEDTRACE
+	/*
+	 * Time (in ns) this thread last became runnable, or 0. See
+	 * schedtrace.h.
+	 */
+	uint64_t t_readytime;
+#endif
+
+#if OPT_LOCKDEP
+	/* Classes of the locks this thread holds. See lockdep.h. */
+	int t_lockdep_held[LOCKDEP_MAXHELD];
+	unsigned t_lockdep_nheld;
+#endif
+
 	/*
 	 * Public fields
 	 */
 
 	/* add more here as needed */
+#if OPT_A3
+	unsigned t_tid;			/* User thread id within t_proc */
+#endif
 };
 
 /*
@@ -168,5 +193,12 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Report the number of threads woken onto other cpus' remote wakeup
+ * lists, and the number of compare-and-swap retries that took, summed
+ * over all cpus. For benchmarking.
+ */
+void thread_wakeupstats(unsigned *sent, unsigned *retries);
+
 
 #endif /* _THREAD_H_ */
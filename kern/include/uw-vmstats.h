@@ -12,7 +12,8 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions (except vmstats_print) whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by holding stats_lock
+ * (a seqlock) for writing.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally (except vmstats_print).
  *
@@ -52,7 +53,10 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
 void vmstats_inc(unsigned int index);    /* uses locking */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Copy out all of the counts at once, consistently */
+void vmstats_snapshot(unsigned int counts[VMSTAT_COUNT]);  /* lock-free read */
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
-void vmstats_print(void);                    /* Does NOT use locking */
+void vmstats_print(void);                    /* prints a snapshot */
 
 #endif /* VM_STATS_H */
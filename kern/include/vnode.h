@@ -30,9 +30,11 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <spinlock.h>
 
 struct uio;
 struct stat;
+struct pollent;
 
 /*
  * A struct vnode is an abstract representation of a file.
@@ -60,6 +62,9 @@ struct vnode {
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	struct spinlock vn_writelock;   /* Protects vn_writegen */
+	volatile unsigned vn_writegen;  /* Bumped by each write/truncate */
 };
 
 /*
@@ -147,6 +152,12 @@ struct vnode {
  *                      uio. Need not work on objects that are not
  *                      directories.
  *
+ *    vop_poll        - Set *REVENTS to those of EVENTS (POLLIN, POLLOUT)
+ *                      that could be done now without waiting, plus
+ *                      POLLERR or POLLHUP if they apply. If PE is not
+ *                      NULL, first hang it with pollhead_add wherever
+ *                      a change of state will wake it. See poll.h.
+ *
  *****************************************
  *
  *    vop_creat       - Create a regular file named NAME in the passed
@@ -212,6 +223,8 @@ struct vnode_ops {
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollent *pe, int *revents);
 
 
 	int (*vop_creat)(struct vnode *dir, 
@@ -248,15 +261,16 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              (vnode_write(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           (vnode_truncate(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
+#define VOP_POLL(vn, ev, pe, rev)       (__VOP(vn, poll)(vn, ev, pe, rev))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
 #define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
@@ -274,6 +288,36 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * Note that VN's contents may have changed, so anything cached about
+ * it as of an older vn_writegen is out of date. Passes RESULT, the
+ * result of the write or truncate, through.
+ */
+int vnode_written(struct vnode *vn, int result);
+
+/*
+ * VOP_WRITE and VOP_TRUNCATE: the operation, then vnode_written.
+ * Functions rather than macros so that VN is only evaluated once.
+ */
+int vnode_write(struct vnode *vn, struct uio *uio);
+int vnode_truncate(struct vnode *vn, off_t pos);
+
+#ifndef VNODEINLINE
+#define VNODEINLINE INLINE
+#endif
+
+VNODEINLINE int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	return vnode_written(vn, __VOP(vn, write)(vn, uio));
+}
+
+VNODEINLINE int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	return vnode_written(vn, __VOP(vn, truncate)(vn, pos));
+}
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
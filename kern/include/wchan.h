@@ -75,8 +75,8 @@ void wchan_sleep(struct wchan *wc);
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
  *
- * The current implementation is FIFO but this is not promised by the
- * interface.
+ * wchan_wakeone wakes the thread that has been sleeping longest.
+ * FIFO semaphores and locks depend on this.
  */
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
@@ -0,0 +1,315 @@
+/*
+ * Open files and file descriptor tables. See filetable.h.
+ *
+ * Each table has a spinlock that covers its slots; openfile reference
+ * counts have their own. Nothing that can sleep (vfs_close in
+ * particular) is done while holding either: callers take openfiles
+ * out of the table first and drop them afterwards.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <pipe.h>
+#include <filetable.h>
+
+/*
+ * Make an openfile for VN, which must already be open; on success it
+ * takes over the caller's reference.
+ */
+static
+int
+openfile_create(struct vnode *vn, int flags, struct openfile **ret)
+{
+    struct openfile *of;
+
+    of = kmalloc(sizeof(struct openfile));
+    if (of == NULL) {
+        return(ENOMEM);
+    }
+    of->of_lock = lock_create("openfile");
+    if (of->of_lock == NULL) {
+        kfree(of);
+        return(ENOMEM);
+    }
+
+    of->of_vnode = vn;
+    // O_CREAT, O_EXCL and O_TRUNC only matter to vfs_open
+    of->of_flags = flags & (O_ACCMODE | O_APPEND);
+    of->of_offset = 0;
+    spinlock_init(&of->of_reflock);
+    of->of_refcount = 1;
+
+    *ret = of;
+    return(0);
+}
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+    struct vnode *vn;
+    int result;
+
+    result = vfs_open(path, flags, mode, &vn);
+    if (result) {
+        return(result);
+    }
+    result = openfile_create(vn, flags, ret);
+    if (result) {
+        vfs_close(vn);
+    }
+    return(result);
+}
+
+int
+openfile_pipe(struct openfile **rret, struct openfile **wret)
+{
+    struct vnode *rvn, *wvn;
+    int result;
+
+    result = pipe_create(&rvn, &wvn);
+    if (result) {
+        return(result);
+    }
+    result = openfile_create(rvn, O_RDONLY, rret);
+    if (result) {
+        vfs_close(rvn);
+        vfs_close(wvn);
+        return(result);
+    }
+    result = openfile_create(wvn, O_WRONLY, wret);
+    if (result) {
+        openfile_decref(*rret);
+        vfs_close(wvn);
+        return(result);
+    }
+    return(0);
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+    spinlock_acquire(&of->of_reflock);
+    KASSERT(of->of_refcount > 0);
+    of->of_refcount++;
+    spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+    unsigned refs;
+
+    spinlock_acquire(&of->of_reflock);
+    KASSERT(of->of_refcount > 0);
+    refs = --of->of_refcount;
+    spinlock_release(&of->of_reflock);
+
+    if (refs == 0) {
+        vfs_close(of->of_vnode);
+        lock_destroy(of->of_lock);
+        spinlock_cleanup(&of->of_reflock);
+        kfree(of);
+    }
+}
+
+static
+struct filetable *
+filetable_create(void)
+{
+    struct filetable *ft;
+    unsigned i;
+
+    ft = kmalloc(sizeof(struct filetable));
+    if (ft == NULL) {
+        return NULL;
+    }
+    spinlock_init(&ft->ft_lock);
+    ft->ft_lowfree = 0;
+    for (i = 0; i < OPEN_MAX; i++) {
+        ft->ft_files[i] = NULL;
+    }
+    return ft;
+}
+
+/*
+ * stdin gets an openfile of its own; stdout and stderr share one, as
+ * they would after a shell's 2>&1.
+ */
+struct filetable *
+filetable_create_console(void)
+{
+    struct filetable *ft;
+    struct openfile *in, *out;
+    char path[5];
+    int result;
+
+    ft = filetable_create();
+    if (ft == NULL) {
+        return NULL;
+    }
+
+    // vfs_open mangles the path, so give it a fresh copy each time
+    strcpy(path, "con:");
+    result = openfile_open(path, O_RDONLY, 0, &in);
+    if (result) {
+        filetable_destroy(ft);
+        return NULL;
+    }
+    strcpy(path, "con:");
+    result = openfile_open(path, O_WRONLY, 0, &out);
+    if (result) {
+        openfile_decref(in);
+        filetable_destroy(ft);
+        return NULL;
+    }
+
+    openfile_incref(out);
+    ft->ft_files[STDIN_FILENO] = in;
+    ft->ft_files[STDOUT_FILENO] = out;
+    ft->ft_files[STDERR_FILENO] = out;
+    ft->ft_lowfree = STDERR_FILENO + 1;
+    return ft;
+}
+
+struct filetable *
+filetable_copy(struct filetable *src)
+{
+    struct filetable *ft;
+    unsigned i;
+
+    ft = filetable_create();
+    if (ft == NULL) {
+        return NULL;
+    }
+
+    spinlock_acquire(&src->ft_lock);
+    for (i = 0; i < OPEN_MAX; i++) {
+        if (src->ft_files[i] != NULL) {
+            openfile_incref(src->ft_files[i]);
+            ft->ft_files[i] = src->ft_files[i];
+        }
+    }
+    ft->ft_lowfree = src->ft_lowfree;
+    spinlock_release(&src->ft_lock);
+
+    return ft;
+}
+
+/*
+ * Only the owner can get here, with no other threads left, so the
+ * slots can be read without the lock.
+ */
+void
+filetable_destroy(struct filetable *ft)
+{
+    unsigned i;
+
+    for (i = 0; i < OPEN_MAX; i++) {
+        if (ft->ft_files[i] != NULL) {
+            openfile_decref(ft->ft_files[i]);
+            ft->ft_files[i] = NULL;
+        }
+    }
+    spinlock_cleanup(&ft->ft_lock);
+    kfree(ft);
+}
+
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *fd)
+{
+    unsigned i;
+
+    spinlock_acquire(&ft->ft_lock);
+    for (i = ft->ft_lowfree; i < OPEN_MAX; i++) {
+        if (ft->ft_files[i] == NULL) {
+            break;
+        }
+    }
+    ft->ft_lowfree = i;
+    if (i == OPEN_MAX) {
+        spinlock_release(&ft->ft_lock);
+        return(EMFILE);
+    }
+    ft->ft_files[i] = of;
+    ft->ft_lowfree = i + 1;
+    spinlock_release(&ft->ft_lock);
+
+    *fd = i;
+    return(0);
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+    struct openfile *of;
+
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return(EBADF);
+    }
+
+    spinlock_acquire(&ft->ft_lock);
+    of = ft->ft_files[fd];
+    if (of != NULL) {
+        // another thread could close it as soon as we let go
+        openfile_incref(of);
+    }
+    spinlock_release(&ft->ft_lock);
+
+    if (of == NULL) {
+        return(EBADF);
+    }
+    *ret = of;
+    return(0);
+}
+
+int
+filetable_remove(struct filetable *ft, int fd, struct openfile **ret)
+{
+    struct openfile *of;
+
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return(EBADF);
+    }
+
+    spinlock_acquire(&ft->ft_lock);
+    of = ft->ft_files[fd];
+    if (of != NULL) {
+        ft->ft_files[fd] = NULL;
+        if ((unsigned)fd < ft->ft_lowfree) {
+            ft->ft_lowfree = fd;
+        }
+    }
+    spinlock_release(&ft->ft_lock);
+
+    if (of == NULL) {
+        return(EBADF);
+    }
+    *ret = of;
+    return(0);
+}
+
+int
+filetable_replace(struct filetable *ft, int fd, struct openfile *of,
+        struct openfile **old)
+{
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return(EBADF);
+    }
+
+    // ft_lowfree is still a lower bound, so it can stay as it is
+    spinlock_acquire(&ft->ft_lock);
+    *old = ft->ft_files[fd];
+    ft->ft_files[fd] = of;
+    spinlock_release(&ft->ft_lock);
+
+    return(0);
+}
+
+#endif /* OPT_A2 */
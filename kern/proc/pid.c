@@ -31,31 +31,130 @@
 #define EXITCODE_NULL -1
 #define PID_NULL -1
 #define PID_KERN 0
+#define PID_COUNT (PID_MAX - PID_MIN + 1)
+#define PID_SHARDS 16
+#define PID_SHARD(pid) ((pid) % PID_SHARDS)
 #include <types.h>
 #include <limits.h>
+#include <kern/wait.h>
 #include <current.h>
 #include <proc.h>
 #include <pid.h>
 #include <kern/errno.h>
 
+/*
+ * Free pids are kept in a FIFO ring: allocation takes from the head
+ * and freeing puts back at the tail, so both are O(1), pids wrap
+ * around, and a freed pid isn't handed out again until every other
+ * free pid has been. That keeps a stale pid from naming a new process
+ * for as long as possible. PID_MAX fits in 16 bits.
+ *
+ * The table itself is split into PID_SHARDS shards by pid, each with
+ * its own lock, so unrelated forks, exits and waits don't meet. An
+ * entry's slot in pid_table and its p_first_child are protected by
+ * the lock of its own shard. Its p_parent_pid, p_exitcode and sibling
+ * links belong to the parent as well, so changing them needs both
+ * shard locks, and either one is enough to read them; the parent
+ * walks its children and sleeps holding only its own. When two shard
+ * locks are needed they are taken in shard order.
+ *
+ * Each entry links its children through p_first_child and the
+ * children's sibling links, so exit and reap touch only the children.
+ * A child's exit wakes p_cv in its parent's entry, which is made the
+ * first time the parent has to wait.
+ */
 static struct pid_stat *pid_table[PID_MAX + 1];
-static pid_t pid_next_available = PID_MIN - 1;
-static pid_t pid_max_assigned = PID_KERN;
-static struct lock *pid_lock;
+static struct lock *pid_shard_lock[PID_SHARDS];
+static uint16_t pid_free[PID_COUNT];
+static unsigned pid_free_head;
+static unsigned pid_free_count;
+static struct spinlock pid_free_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+pid_free_put(pid_t pid)
+{
+    KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+
+    spinlock_acquire(&pid_free_lock);
+    KASSERT(pid_free_count < PID_COUNT);
+    pid_free[(pid_free_head + pid_free_count) % PID_COUNT] = pid;
+    pid_free_count ++;
+    spinlock_release(&pid_free_lock);
+}
+
+static
+pid_t
+pid_free_get(void)
+{
+    pid_t pid = PID_NULL;
+
+    spinlock_acquire(&pid_free_lock);
+    if (pid_free_count > 0) {
+        pid = pid_free[pid_free_head];
+        pid_free_head = (pid_free_head + 1) % PID_COUNT;
+        pid_free_count --;
+    }
+    spinlock_release(&pid_free_lock);
+    return(pid);
+}
+
+static
+struct lock *
+pid_lockof(pid_t pid)
+{
+    return(pid_shard_lock[PID_SHARD(pid)]);
+}
+
+/*
+ * Take the shard locks for A and B, in order. A may be PID_NULL.
+ */
+static
+void
+pid_lock_pair(pid_t a, pid_t b)
+{
+    if (a == PID_NULL || PID_SHARD(a) == PID_SHARD(b)) {
+        lock_acquire(pid_lockof(b));
+    } else if (PID_SHARD(a) < PID_SHARD(b)) {
+        lock_acquire(pid_lockof(a));
+        lock_acquire(pid_lockof(b));
+    } else {
+        lock_acquire(pid_lockof(b));
+        lock_acquire(pid_lockof(a));
+    }
+}
+
+static
+void
+pid_unlock_pair(pid_t a, pid_t b)
+{
+    lock_release(pid_lockof(b));
+    if (a != PID_NULL && PID_SHARD(a) != PID_SHARD(b)) {
+        lock_release(pid_lockof(a));
+    }
+}
 
 void
 pid_bootstrap(void)
 {
-    // initialize lock
-    pid_lock = lock_create("pid_lock");
+    char name[16];
 
-    // initialize pid table
+    // initialize locks; separate names so lockdep can order them
+    for (int i = 0; i < PID_SHARDS; i++) {
+        snprintf(name, sizeof(name), "pid_shard%d", i);
+        pid_shard_lock[i] = lock_create(name);
+        if (pid_shard_lock[i] == NULL) {
+            panic("Could not create pid lock");
+        }
+    }
+
+    // initialize pid table and free pids, handed out in order at first
+    pid_free_head = 0;
+    pid_free_count = 0;
     for (pid_t pid = PID_MIN; pid <= PID_MAX; ++pid) {
         pid_table[pid] = NULL;
+        pid_free_put(pid);
     }
-
-    // initialize next available pid
-    pid_next_available = PID_MIN; 
 }
 
 void
@@ -67,156 +166,311 @@ pid_assign_kern(struct proc *proc_kern)
 void
 pid_assign_next(struct proc *proc_child)
 {
+    struct pid_stat *pid_stat_parent;
+    pid_t pid_parent = curproc->p_pid;
+    pid_t pid;
+
     // allocate pid stat struct for current proc
     struct pid_stat *pid_stat_current = kmalloc(sizeof(struct pid_stat));
     if (pid_stat_current == NULL) {
         panic("Out of memory while attempting to allocate pid stat"); 
     }
 
-    // assign parent pid
-    pid_stat_current->p_parent_pid = curproc->p_pid;
-
-    // assign cv
-    pid_stat_current->p_cv = cv_create(proc_child->p_name);
-
     // assign exit code
     pid_stat_current->p_exitcode = EXITCODE_NULL;
 
-    lock_acquire(pid_lock);
-    // assign next available pid
-    proc_child->p_pid = pid_next_available;
+    // no children yet, and nobody to wait for them
+    pid_stat_current->p_cv = NULL;
+    pid_stat_current->p_first_child = PID_NULL;
+    pid_stat_current->p_prev_sibling = PID_NULL;
+    pid_stat_current->p_next_sibling = PID_NULL;
 
-    // assign pid stat struct to pid table
-    pid_table[pid_next_available] = pid_stat_current;
-    if (pid_next_available > pid_max_assigned) {
-        pid_max_assigned = pid_next_available;
+    // take the next free pid
+    pid = pid_free_get();
+    if (pid == PID_NULL) {
+        panic("Out of available process id");
     }
+    proc_child->p_pid = pid;
 
-    // probe for next available pid
-    while (pid_table[pid_next_available] != NULL) {
-        pid_next_available ++;
+    // the kernel has no entry and never waits, so nobody will reap it
+    if (pid_parent < PID_MIN) {
+        pid_parent = PID_NULL;
     }
-    lock_release(pid_lock);
+    pid_stat_current->p_parent_pid = pid_parent;
 
-    // panic if we ran out of pid
-    if (pid_next_available > PID_MAX) {
-        panic("Out of available process id");
+    pid_lock_pair(pid_parent, pid);
+    // assign pid stat struct to pid table
+    KASSERT(pid_table[pid] == NULL);
+    pid_table[pid] = pid_stat_current;
+
+    // put it at the head of the parent's children
+    if (pid_parent != PID_NULL) {
+        pid_stat_parent = pid_table[pid_parent];
+        KASSERT(pid_stat_parent != NULL);
+        pid_stat_current->p_next_sibling = pid_stat_parent->p_first_child;
+        if (pid_stat_parent->p_first_child != PID_NULL) {
+            pid_table[pid_stat_parent->p_first_child]->p_prev_sibling = pid;
+        }
+        pid_stat_parent->p_first_child = pid;
     }
+    pid_unlock_pair(pid_parent, pid);
 }
 
-int
-pid_wait(pid_t pid, int *exitstatus)
+/*
+ * Take PID off its parent's list of children and forget the parent.
+ * Needs both shard locks.
+ */
+static
+void
+pid_unlink(pid_t pid)
 {
-    pid_t pid_parent = curproc->p_pid;
+    struct pid_stat *ps = pid_table[pid];
+    struct pid_stat *pid_stat_parent;
 
-    lock_acquire(pid_lock);
-    if (pid_table[pid] == NULL) {
-        lock_release(pid_lock);
-        return(ESRCH);
+    KASSERT(ps != NULL);
+    KASSERT(lock_do_i_hold(pid_lockof(pid)));
+
+    if (ps->p_parent_pid == PID_NULL) {
+        return;
+    }
+    KASSERT(lock_do_i_hold(pid_lockof(ps->p_parent_pid)));
+    pid_stat_parent = pid_table[ps->p_parent_pid];
+    if (ps->p_prev_sibling != PID_NULL) {
+        pid_table[ps->p_prev_sibling]->p_next_sibling = ps->p_next_sibling;
     } else {
-        if (pid_table[pid]->p_parent_pid == pid_parent) {
-            while (pid_table[pid]->p_exitcode == EXITCODE_NULL) {
-                cv_wait(pid_table[pid]->p_cv, pid_lock);            
-            }
-            *exitstatus = pid_table[pid]->p_exitcode;
-            lock_release(pid_lock);
-            return (0);
-        } else {
-            lock_release(pid_lock);
-            return(ECHILD);
-        } 
+        KASSERT(pid_stat_parent->p_first_child == pid);
+        pid_stat_parent->p_first_child = ps->p_next_sibling;
+    }
+    if (ps->p_next_sibling != PID_NULL) {
+        pid_table[ps->p_next_sibling]->p_prev_sibling = ps->p_prev_sibling;
     }
+    ps->p_parent_pid = PID_NULL;
+    ps->p_prev_sibling = PID_NULL;
+    ps->p_next_sibling = PID_NULL;
 }
 
+/*
+ * Free PID's entry and give the pid back. The process must be gone
+ * (or never have run), and have no parent and no children left.
+ */
 static
 void
 pid_destroy(pid_t pid) 
 {
+    struct pid_stat *ps = pid_table[pid];
+
     // make sure lock is held
-    KASSERT(lock_do_i_hold(pid_lock));
+    KASSERT(lock_do_i_hold(pid_lockof(pid)));
     // make sure pid stat exists
-    KASSERT(pid_table[pid] != NULL);
-    // make sure process has exited
-    KASSERT(pid_table[pid]->p_exitcode != EXITCODE_NULL);
-    // make sure process has no alive parent process
-    KASSERT(pid_table[pid]->p_parent_pid == PID_NULL);
+    KASSERT(ps != NULL);
+    // make sure process has no alive parent process or children
+    KASSERT(ps->p_parent_pid == PID_NULL);
+    KASSERT(ps->p_first_child == PID_NULL);
     
     // remove current pid stat
-    kfree(pid_table[pid]);
     pid_table[pid] = NULL;
+    if (ps->p_cv != NULL) {
+        cv_destroy(ps->p_cv);
+    }
+    kfree(ps);
+    pid_free_put(pid);
+}
+
+/*
+ * Find an exited child of PID_PARENT: PID itself, or any if PID is -1.
+ * Called with the parent's shard lock. Returns 0 and the child in
+ * *PID_FOUND (or PID_NULL if none has exited yet), or an error if
+ * there is no such child.
+ */
+static
+int
+pid_find_exited(pid_t pid_parent, pid_t pid, pid_t *pid_found)
+{
+    pid_t pid_child;
+    bool any = false;
+
+    KASSERT(lock_do_i_hold(pid_lockof(pid_parent)));
+
+    *pid_found = PID_NULL;
+    for (pid_child = pid_table[pid_parent]->p_first_child;
+            pid_child != PID_NULL;
+            pid_child = pid_table[pid_child]->p_next_sibling) {
+        if (pid != -1 && pid_child != pid) {
+            continue;
+        }
+        any = true;
+        if (pid_table[pid_child]->p_exitcode != EXITCODE_NULL) {
+            *pid_found = pid_child;
+            return(0);
+        }
+    }
+    return(any ? 0 : ECHILD);
+}
+
+int
+pid_wait(pid_t pid, int options, pid_t *pid_reaped, int *exitstatus)
+{
+    pid_t pid_parent = curproc->p_pid;
+    struct lock *lock_parent;
+    pid_t pid_child;
+    int result;
 
-    if (pid < pid_next_available) {
-        pid_next_available = pid;
+    if (pid != -1 && (pid < PID_MIN || pid > PID_MAX)) {
+        return(ESRCH);
+    }
+    if (pid_parent < PID_MIN) {
+        // the kernel doesn't keep track of its children
+        return(ECHILD);
+    }
+    lock_parent = pid_lockof(pid_parent);
+
+    lock_acquire(lock_parent);
+    if (pid != -1 && PID_SHARD(pid) != PID_SHARD(pid_parent)) {
+        // a quick look to tell an unknown pid from somebody else's child
+        lock_release(lock_parent);
+        lock_acquire(pid_lockof(pid));
+        result = (pid_table[pid] == NULL) ? ESRCH : 0;
+        lock_release(pid_lockof(pid));
+        if (result) {
+            return(result);
+        }
+        lock_acquire(lock_parent);
+    } else if (pid != -1 && pid_table[pid] == NULL) {
+        lock_release(lock_parent);
+        return(ESRCH);
+    }
+
+    while (1) {
+        result = pid_find_exited(pid_parent, pid, &pid_child);
+        if (result) {
+            lock_release(lock_parent);
+            return(result);
+        }
+        if (pid_child != PID_NULL) {
+            // got one; take its shard lock too, in order
+            if (PID_SHARD(pid_child) != PID_SHARD(pid_parent)) {
+                lock_release(lock_parent);
+                pid_lock_pair(pid_parent, pid_child);
+                // another thread of ours may have reaped it meanwhile
+                if (pid_table[pid_child] == NULL ||
+                        pid_table[pid_child]->p_parent_pid != pid_parent) {
+                    lock_release(pid_lockof(pid_child));
+                    continue;
+                }
+            }
+            *exitstatus = pid_table[pid_child]->p_exitcode;
+            *pid_reaped = pid_child;
+            // reaped: nobody can ask for this one again
+            pid_unlink(pid_child);
+            pid_destroy(pid_child);
+            pid_unlock_pair(pid_parent, pid_child);
+            return(0);
+        }
+        if (options & WNOHANG) {
+            lock_release(lock_parent);
+            *pid_reaped = 0;
+            return(0);
+        }
+        if (pid_table[pid_parent]->p_cv == NULL) {
+            pid_table[pid_parent]->p_cv = cv_create("pid_wait");
+            if (pid_table[pid_parent]->p_cv == NULL) {
+                lock_release(lock_parent);
+                return(ENOMEM);
+            }
+        }
+        cv_wait(pid_table[pid_parent]->p_cv, lock_parent);
     }
 }
 
+/*
+ * Orphan the children of PID_PARENT, which is exiting, and get rid of
+ * the ones that have already exited.
+ */
 static
 void
 pid_cleanup(pid_t pid_parent) 
 {
-    // make sure lock is held
-    KASSERT(lock_do_i_hold(pid_lock));
-    // make sure parent process has exited
-    KASSERT(pid_table[pid_parent] == NULL 
-            || pid_table[pid_parent]->p_exitcode != EXITCODE_NULL);
-
-    // unlink children processes and remove interest
-    for (pid_t pid_child = PID_MIN; pid_child <= pid_max_assigned; ++pid_child) {
-        if (pid_table[pid_child] != NULL && 
+    pid_t pid_child;
+
+    while (1) {
+        lock_acquire(pid_lockof(pid_parent));
+        pid_child = pid_table[pid_parent]->p_first_child;
+        lock_release(pid_lockof(pid_parent));
+        if (pid_child == PID_NULL) {
+            break;
+        }
+
+        pid_lock_pair(pid_parent, pid_child);
+        // it may have been reaped in the meantime
+        if (pid_table[pid_child] != NULL &&
                 pid_table[pid_child]->p_parent_pid == pid_parent) {
-            pid_table[pid_child]->p_parent_pid = PID_NULL;
+            // unlink children processes and remove interest
+            pid_unlink(pid_child);
             if (pid_table[pid_child]->p_exitcode != EXITCODE_NULL) {
                 // if child has already exited 
                 pid_destroy(pid_child);
             }
         }
+        pid_unlock_pair(pid_parent, pid_child);
     }
 }
 
 void
 pid_exit(int exitcode)
 {
-    lock_acquire(pid_lock);
     // retrieve process id
     pid_t pid = curproc->p_pid;
+    pid_t pid_parent;
+
+    // clean up parent children linkages
+    pid_cleanup(pid);
+
+    // our parent can only go from alive to gone, so one retry is enough
+    lock_acquire(pid_lockof(pid));
+    pid_parent = pid_table[pid]->p_parent_pid;
+    lock_release(pid_lockof(pid));
+    pid_lock_pair(pid_parent, pid);
+    if (pid_table[pid]->p_parent_pid != pid_parent) {
+        KASSERT(pid_table[pid]->p_parent_pid == PID_NULL);
+        pid_unlock_pair(pid_parent, pid);
+        pid_parent = PID_NULL;
+        pid_lock_pair(pid_parent, pid);
+    }
 
     // assign exit code
     pid_table[pid]->p_exitcode = exitcode;
 
-    if (pid_table[pid]->p_parent_pid == PID_NULL) {
+    if (pid_parent == PID_NULL) {
         // if there is no parent process that is interested in this process' exit code
         // destroy pid stat
         pid_destroy(pid);
-    } else {
+    } else if (pid_table[pid_parent]->p_cv != NULL) {
         // if there is a parent process that is interested in this process' exit code
-        // signal parent processe waiting on the wait channel
-        cv_signal(pid_table[pid]->p_cv, pid_lock);
+        // wake it if it's waiting
+        cv_broadcast(pid_table[pid_parent]->p_cv, pid_lockof(pid_parent));
     }
-
-    // clean up parent children linkages
-    pid_cleanup(pid);
-    lock_release(pid_lock);
+    pid_unlock_pair(pid_parent, pid);
 }
 
+/*
+ * Give back the pid of a child that never got to run.
+ */
 void
-pid_fail(void)
+pid_fail(struct proc *proc_child)
 {
-    lock_acquire(pid_lock);
-
-    // retrieve process id
-    pid_t pid = curproc->p_pid;
-
-    if (pid_table[pid] != NULL) {
-        // remove current pid stat
-        kfree(pid_table[pid]);
-        pid_table[pid] = NULL;
+    pid_t pid = proc_child->p_pid;
+    pid_t pid_parent = curproc->p_pid;
 
-        if (pid < pid_next_available) {
-            pid_next_available = pid;
-        }
+    if (pid_parent < PID_MIN) {
+        pid_parent = PID_NULL;
     }
 
-    lock_release(pid_lock);
+    pid_lock_pair(pid_parent, pid);
+    KASSERT(pid_table[pid] != NULL);
+    KASSERT(pid_table[pid]->p_parent_pid == pid_parent);
+    pid_unlink(pid);
+    pid_destroy(pid);
+    pid_unlock_pair(pid_parent, pid);
 }
 
 
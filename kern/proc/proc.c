@@ -43,7 +43,9 @@
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
+#include <kern/errno.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
@@ -52,6 +54,7 @@
 #include <synch.h>
 #include <kern/fcntl.h>  
 #include <pid.h>
+#include <filetable.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -101,10 +104,27 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
+#if defined(UW) && !OPT_A2
 	proc->console = NULL;
 #endif // UW
 
+#if OPT_A2
+	proc->p_files = NULL;
+	proc->p_vfork_wait = NULL;
+#endif /* OPT_A2 */
+
+#if OPT_A3
+	proc->p_tlock = NULL;
+	proc->p_tcv = NULL;
+	proc->p_tlive = 0;
+	proc->p_tfirst = 0;
+	proc->p_texiting = false;
+	for (unsigned i = 0; i < PROC_MAXTHREADS; i++) {
+		proc->p_tstate[i] = PROC_TFREE;
+		proc->p_texitval[i] = 0;
+	}
+#endif /* OPT_A3 */
+
 	return proc;
 }
 
@@ -159,12 +179,27 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
+#if OPT_A2
+	/* normally closed already, by sys__exit */
+	if (proc->p_files) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+	}
+#elif defined(UW)
 	if (proc->console) {
 	  vfs_close(proc->console);
 	}
 #endif // UW
 
+#if OPT_A3
+	if (proc->p_tcv) {
+		cv_destroy(proc->p_tcv);
+	}
+	if (proc->p_tlock) {
+		lock_destroy(proc->p_tlock);
+	}
+#endif /* OPT_A3 */
+
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
@@ -220,20 +255,72 @@ proc_bootstrap(void)
  * Create a fresh proc for use by runprogram.
  *
  * It will have no address space and will inherit the current
- * process's (that is, the kernel menu's) current directory.
+ * process's (that is, the kernel menu's) current directory. Its
+ * one user thread gets id TID.
  */
 struct proc *
-proc_create_runprogram(const char *name)
+proc_create_runprogram(const char *name, unsigned tid)
 {
 	struct proc *proc;
+#if !OPT_A2
 	char *console_path;
+#endif
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-#ifdef UW
+#if OPT_A2
+	/* inherit the parent's open files, or start out on the console */
+	if (curproc->p_files != NULL) {
+		proc->p_files = filetable_copy(curproc->p_files);
+	} else {
+		proc->p_files = filetable_create_console();
+	}
+	if (proc->p_files == NULL) {
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+#endif /* OPT_A2 */
+
+#if OPT_A3
+	proc->p_tlock = lock_create("p_tlock");
+	proc->p_tcv = cv_create("p_tcv");
+	if (proc->p_tlock == NULL || proc->p_tcv == NULL) {
+		if (proc->p_tcv) {
+			cv_destroy(proc->p_tcv);
+		}
+		if (proc->p_tlock) {
+			lock_destroy(proc->p_tlock);
+		}
+#if OPT_A2
+		filetable_destroy(proc->p_files);
+#endif /* OPT_A2 */
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
+	/*
+	 * The process starts with one user thread. For fork, that
+	 * thread keeps the id (and so the user stack) of the thread
+	 * that called fork; otherwise it's thread 0.
+	 */
+	KASSERT(tid < PROC_MAXTHREADS);
+	proc->p_tfirst = tid;
+	proc->p_tstate[tid] = PROC_TRUNNING;
+	proc->p_tlive = 1;
+#else
+	(void)tid;
+#endif /* OPT_A3 */
+
+#if defined(UW) && !OPT_A2
 	/* open the console - this should always succeed */
 	console_path = kstrdup("con:");
 	if (console_path == NULL) {
@@ -283,6 +370,32 @@ proc_create_runprogram(const char *name)
 	return proc;
 }
 
+#if OPT_A2
+/*
+ * Called when the current process has just had its address space
+ * taken off it, by execv or on the way out. If it was made by vfork,
+ * that address space was its parent's: let the parent go on, and
+ * return true to tell the caller not to destroy it.
+ */
+bool
+proc_vfork_release(void)
+{
+	struct proc *proc = curproc;
+	struct semaphore *wait;
+
+	spinlock_acquire(&proc->p_lock);
+	wait = proc->p_vfork_wait;
+	proc->p_vfork_wait = NULL;
+	spinlock_release(&proc->p_lock);
+
+	if (wait == NULL) {
+		return false;
+	}
+	V(wait);
+	return true;
+}
+#endif /* OPT_A2 */
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -373,3 +486,206 @@ curproc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+#if OPT_A3
+/*
+ * User-level threads.
+ *
+ * Each user thread holds a thread id (t_tid), which is also the slot
+ * its user stack lives in. p_tstate[] says which ids are in use; a
+ * thread that exits keeps its id, and so its stack, until another
+ * thread joins it.
+ *
+ * p_tlive counts the user threads still attached to the process. A
+ * thread leaving the process detaches itself before dropping p_tlive,
+ * so once p_tlive reaches 1 the remaining thread knows it is alone
+ * and may tear down the address space and the process.
+ *
+ * To get rid of the other threads (for _exit, execv, or a fatal
+ * fault) a thread sets p_texiting and waits for p_tlive to drop to 1.
+ * The others notice p_texiting on their way back to user mode (see
+ * proc_uthread_checkexit, called from the trap code) and leave. A
+ * thread blocked in some other system call is not interrupted; it
+ * leaves when that call returns.
+ */
+
+/*
+ * Detach the current thread from PROC and exit. Called with p_tlock
+ * held. Does not return.
+ */
+static
+void
+proc_uthread_leave(struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proc->p_tlock));
+	KASSERT(proc->p_tlive > 1);
+
+	proc_remthread(curthread);
+	proc->p_tlive--;
+	cv_broadcast(proc->p_tcv, proc->p_tlock);
+	lock_release(proc->p_tlock);
+
+	/* PROC may be gone now. */
+	thread_exit();
+}
+
+/*
+ * Reserve a thread id (and stack slot) in PROC for a new thread.
+ */
+int
+proc_uthread_alloc(struct proc *proc, unsigned *tid)
+{
+	unsigned i;
+
+	lock_acquire(proc->p_tlock);
+	if (proc->p_texiting) {
+		lock_release(proc->p_tlock);
+		return EINTR;
+	}
+	/* id 0 is the ordinary stack, which the process's argv lives on */
+	for (i = 1; i < PROC_MAXTHREADS; i++) {
+		if (proc->p_tstate[i] == PROC_TFREE) {
+			proc->p_tstate[i] = PROC_TRUNNING;
+			proc->p_texitval[i] = 0;
+			proc->p_tlive++;
+			lock_release(proc->p_tlock);
+			*tid = i;
+			return 0;
+		}
+	}
+	lock_release(proc->p_tlock);
+	return EAGAIN;
+}
+
+/*
+ * Give back a thread id from proc_uthread_alloc whose thread never
+ * got started.
+ */
+void
+proc_uthread_free(struct proc *proc, unsigned tid)
+{
+	KASSERT(tid < PROC_MAXTHREADS);
+
+	lock_acquire(proc->p_tlock);
+	KASSERT(proc->p_tstate[tid] == PROC_TRUNNING);
+	proc->p_tstate[tid] = PROC_TFREE;
+	proc->p_tlive--;
+	cv_broadcast(proc->p_tcv, proc->p_tlock);
+	lock_release(proc->p_tlock);
+}
+
+/*
+ * Wait for thread TID of the current process to exit, hand back its
+ * exit value, and release its id.
+ */
+int
+proc_uthread_join(unsigned tid, int *exitval)
+{
+	struct proc *proc = curproc;
+	int result;
+
+	if (tid >= PROC_MAXTHREADS) {
+		return ESRCH;
+	}
+	if (tid == curthread->t_tid) {
+		return EINVAL;
+	}
+
+	lock_acquire(proc->p_tlock);
+	while (proc->p_tstate[tid] == PROC_TRUNNING && !proc->p_texiting) {
+		cv_wait(proc->p_tcv, proc->p_tlock);
+	}
+	if (proc->p_texiting) {
+		result = EINTR;
+	}
+	else if (proc->p_tstate[tid] != PROC_TZOMBIE) {
+		result = ESRCH;
+	}
+	else {
+		*exitval = proc->p_texitval[tid];
+		proc->p_tstate[tid] = PROC_TFREE;
+		result = 0;
+	}
+	lock_release(proc->p_tlock);
+	return result;
+}
+
+/*
+ * Exit the current thread with EXITVAL, leaving the rest of the
+ * process running. If this is the only thread left, does nothing and
+ * returns false; the caller should exit the whole process instead.
+ */
+bool
+proc_uthread_exit(int exitval)
+{
+	struct proc *proc = curproc;
+
+	lock_acquire(proc->p_tlock);
+	if (proc->p_tlive == 1) {
+		lock_release(proc->p_tlock);
+		return false;
+	}
+	proc->p_tstate[curthread->t_tid] = PROC_TZOMBIE;
+	proc->p_texitval[curthread->t_tid] = exitval;
+	proc_uthread_leave(proc);
+	panic("proc_uthread_leave returned\n");
+	return true;
+}
+
+/*
+ * Make the current thread the only one in its process. Afterwards it
+ * is thread 0 and all other ids are free.
+ *
+ * If some other thread is already doing this, returns EINTR instead.
+ * That thread is waiting for this one, so the caller should let go of
+ * whatever it holds and head back toward user mode, where
+ * proc_uthread_checkexit makes it leave.
+ */
+int
+proc_uthread_killothers(void)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_tlock);
+	if (proc->p_texiting) {
+		lock_release(proc->p_tlock);
+		return EINTR;
+	}
+	proc->p_texiting = true;
+	cv_broadcast(proc->p_tcv, proc->p_tlock);
+	while (proc->p_tlive > 1) {
+		cv_wait(proc->p_tcv, proc->p_tlock);
+	}
+	for (i = 0; i < PROC_MAXTHREADS; i++) {
+		proc->p_tstate[i] = PROC_TFREE;
+	}
+	proc->p_tstate[0] = PROC_TRUNNING;
+	proc->p_tfirst = 0;
+	curthread->t_tid = 0;
+	proc->p_texiting = false;
+	lock_release(proc->p_tlock);
+	return 0;
+}
+
+/*
+ * Called on the way back to user mode: if another thread wants this
+ * process to itself, leave. p_texiting is checked without the lock
+ * first, and p_tlock is only taken once it's set; the trap code peeks
+ * at it itself before calling, so most returns don't get this far.
+ */
+void
+proc_uthread_checkexit(void)
+{
+	struct proc *proc = curproc;
+
+	if (proc == NULL || proc == kproc || !proc->p_texiting) {
+		return;
+	}
+	lock_acquire(proc->p_tlock);
+	if (proc->p_texiting) {
+		proc_uthread_leave(proc);
+	}
+	lock_release(proc->p_tlock);
+}
+#endif /* OPT_A3 */
@@ -37,15 +37,21 @@
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
+#include <addrspace.h>
 #include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <schedtrace.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-schedtrace.h"
+#include "opt-lockstat.h"
+#include "opt-lockdep.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -158,7 +164,7 @@ common_prog(int nargs, char **args)
 #endif
 
 	/* Create a process for the new program to run in. */
-	proc = proc_create_runprogram(args[0] /* name */);
+	proc = proc_create_runprogram(args[0] /* name */, 0);
 	if (proc == NULL) {
 		return ENOMEM;
 	}
@@ -498,6 +504,14 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Lock benchmark        (1)     ",
+	"[sy5] Rwlock test                   ",
+	"[sy6] Spinlock benchmark            ",
+#if OPT_LOCKDEP
+	"[sy7] Lock order validator test     ",
+#endif
+	"[tb1] Thread fork benchmark         ",
+	"[tb2] Wakeup ping-pong benchmark    ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -538,6 +552,16 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ec] ELF header cache stats         ",
+#if OPT_SCHEDTRACE
+	"[st] Scheduler trace stats          ",
+#endif
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -595,6 +619,16 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ec",		elfcache_cmd },
+#if OPT_SCHEDTRACE
+	{ "st",		schedtrace_cmd },
+#endif
+#if OPT_LOCKSTAT
+	{ "lockstat",	lockstat_cmd },
+#endif
+#if OPT_SFS
+	{ "bc",		sfs_bstats_cmd },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -612,11 +646,21 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	lockbench },
+	{ "sy5",	rwtest },
+	{ "sy6",	spinbench },
+#if OPT_LOCKDEP
+	{ "sy7",	lockdeptest },
+#endif
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
 #endif
 
+	/* thread system benchmarks */
+	{ "tb1",	forkbench },
+	{ "tb2",	wakeupbench },
+
 	/* file system assignment tests */
 	{ "fs1",	fstest },
 	{ "fs2",	readstress },
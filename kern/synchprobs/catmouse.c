@@ -139,6 +139,9 @@ static volatile int cat_wait_count;
 static volatile time_t mouse_total_wait_secs;
 static volatile uint32_t mouse_total_wait_nsecs;
 static volatile int mouse_wait_count;
+/* longest single waits, in microseconds, for the tail of the distribution */
+static volatile int cat_max_wait_usecs;
+static volatile int mouse_max_wait_usecs;
 
 /* mutex to provide mutual exclusion to performance stats */
 static struct semaphore *perf_mutex;
@@ -192,6 +195,8 @@ initialize_bowls()
   mouse_total_wait_secs = 0;
   mouse_total_wait_nsecs = 0;
   mouse_wait_count = 0;
+  cat_max_wait_usecs = 0;
+  mouse_max_wait_usecs = 0;
   
   return;
 }
@@ -549,6 +554,9 @@ cat_simulation(void * unusedpointer,
       cat_total_wait_secs ++;
     }
     cat_wait_count++;
+    if (wait_sec*1000000 + wait_nsec/1000 > cat_max_wait_usecs) {
+      cat_max_wait_usecs = wait_sec*1000000 + wait_nsec/1000;
+    }
     V(perf_mutex);
   }
 
@@ -612,6 +620,9 @@ mouse_simulation(void * unusedpointer,
       mouse_total_wait_secs ++;
     }
     mouse_wait_count++;
+    if (wait_sec*1000000 + wait_nsec/1000 > mouse_max_wait_usecs) {
+      mouse_max_wait_usecs = wait_sec*1000000 + wait_nsec/1000;
+    }
     V(perf_mutex);
   }
 
@@ -776,6 +787,9 @@ catmouse(int nargs,
     utilization_percent = total_eating_milliseconds*100/total_bowl_milliseconds;
     kprintf("STATS: Bowl utilization: %d%%\n",utilization_percent);
   }
+  kprintf("STATS: Simulation time: %d.%03d seconds, %d meals\n",
+          (int)wait_sec, (int)(wait_nsec/1000000),
+          (NumCats+NumMice)*NumLoops);
 
   /* clean up the semaphore that we created */
   sem_destroy(CatMouseWait);
@@ -789,15 +803,23 @@ catmouse(int nargs,
   if (cat_wait_count > 0) {
     /* some rounding error here - not significant if cat_wait_count << 1000000 */
     mean_cat_wait_usecs = (cat_total_wait_secs*1000000+cat_total_wait_nsecs/1000)/cat_wait_count;
-    kprintf("STATS: Mean cat waiting time: %d.%d seconds\n",
+    kprintf("STATS: Mean cat waiting time: %d.%06d seconds\n",
              mean_cat_wait_usecs/1000000,mean_cat_wait_usecs%1000000);
   }
   if (mouse_wait_count > 0) {
     /* some rounding error here - not significant if mouse_wait_count << 1000000 */
     mean_mouse_wait_usecs = (mouse_total_wait_secs*1000000+mouse_total_wait_nsecs/1000)/mouse_wait_count;
-    kprintf("STATS: Mean mouse waiting time: %d.%d seconds\n",
+    kprintf("STATS: Mean mouse waiting time: %d.%06d seconds\n",
              mean_mouse_wait_usecs/1000000,mean_mouse_wait_usecs%1000000);
   }
+  if (cat_wait_count > 0) {
+    kprintf("STATS: Max cat waiting time: %d.%06d seconds\n",
+             cat_max_wait_usecs/1000000,cat_max_wait_usecs%1000000);
+  }
+  if (mouse_wait_count > 0) {
+    kprintf("STATS: Max mouse waiting time: %d.%06d seconds\n",
+             mouse_max_wait_usecs/1000000,mouse_max_wait_usecs%1000000);
+  }
 
   return 0;
 }
@@ -19,7 +19,112 @@
 /*
  * replace this with declarations of any synchronization and other variables you need here
  */
-static struct semaphore *globalCatMouseSem;
+
+/*
+ * Every bowl is used at once, by one species at a time. The species
+ * eating has the turn; while nobody of the other species is waiting,
+ * any free bowl can be taken. Once some are waiting, the species with
+ * the turn may let in at most max_batch more (one round of the bowls),
+ * then it drains, and the last one out hands the turn over. So each
+ * side waits at most about one batch of the other side's meals.
+ *
+ * Creatures wait on a keyed CV, one queue per (species, bowl), so that
+ * finishing at a bowl wakes only someone who wants that bowl, and the
+ * handover wakes one of the other species per bowl. Nobody is woken
+ * just to find they still can't eat.
+ *
+ * The bowls' state is all under one lock, which is only held for a few
+ * instructions; the waits themselves are per bowl.
+ */
+#define CAT 0
+#define MOUSE 1
+#define OTHER(s) (1 - (s))
+
+static struct lock *bowl_lock;
+static struct kcv *bowl_kcv;
+static int num_bowls;
+static bool *bowl_busy;               /* indexed by bowl number - 1 */
+static volatile int eating[2];
+static volatile int waiting[2];
+static volatile int turn;
+static volatile int batch;          /* let in with the other side waiting */
+static int max_batch;
+
+/* kcv_wait returns, and creatures that got to eat after waiting */
+static volatile unsigned wakeups;
+static volatile unsigned useful_wakeups;
+
+static
+unsigned
+bowl_key(int species, unsigned int bowl)
+{
+  return species * num_bowls + (bowl - 1);
+}
+
+static
+bool
+can_eat(int species, unsigned int bowl)
+{
+  return !bowl_busy[bowl - 1] && eating[OTHER(species)] == 0 &&
+    (waiting[OTHER(species)] == 0 ||
+     (turn == species && batch < max_batch));
+}
+
+static
+void
+before_eating(int species, unsigned int bowl)
+{
+  bool waited = false;
+
+  KASSERT(bowl >= 1 && bowl <= (unsigned)num_bowls);
+  lock_acquire(bowl_lock);
+  while (!can_eat(species, bowl)) {
+    waiting[species]++;
+    kcv_wait(bowl_kcv, bowl_lock, bowl_key(species, bowl));
+    waiting[species]--;
+    wakeups++;
+    waited = true;
+  }
+  if (waited) {
+    useful_wakeups++;
+  }
+  if (turn != species) {
+    turn = species;
+    batch = 0;
+  }
+  if (waiting[OTHER(species)] > 0) {
+    batch++;
+  }
+  bowl_busy[bowl - 1] = true;
+  eating[species]++;
+  lock_release(bowl_lock);
+}
+
+static
+void
+after_eating(int species, unsigned int bowl)
+{
+  int other = OTHER(species);
+  int b;
+
+  lock_acquire(bowl_lock);
+  KASSERT(bowl_busy[bowl - 1]);
+  bowl_busy[bowl - 1] = false;
+  eating[species]--;
+  if (eating[species] == 0 && waiting[other] > 0) {
+    /* hand the bowls over: one of the other species per bowl */
+    turn = other;
+    batch = 0;
+    for (b = 1; b <= num_bowls; b++) {
+      kcv_signal(bowl_kcv, bowl_lock, bowl_key(other, b));
+    }
+  }
+  else if (waiting[other] == 0 ||
+           (turn == species && batch < max_batch)) {
+    kcv_signal(bowl_kcv, bowl_lock, bowl_key(species, bowl));
+  }
+  lock_release(bowl_lock);
+}
 
 
 /* 
@@ -33,13 +138,32 @@ static struct semaphore *globalCatMouseSem;
 void
 catmouse_sync_init(int bowls)
 {
-  /* replace this default implementation with your own implementation of catmouse_sync_init */
+  int i;
 
-  (void)bowls; /* keep the compiler from complaining about unused parameters */
-  globalCatMouseSem = sem_create("globalCatMouseSem",1);
-  if (globalCatMouseSem == NULL) {
-    panic("could not create global CatMouse synchronization semaphore");
+  KASSERT(bowls > 0);
+  num_bowls = bowls;
+  bowl_lock = lock_create("bowl_lock");
+  if (bowl_lock == NULL) {
+    panic("could not create bowl lock");
+  }
+  bowl_kcv = kcv_create("bowl_kcv", 2 * bowls);
+  if (bowl_kcv == NULL) {
+    panic("could not create bowl kcv");
+  }
+  bowl_busy = kmalloc(bowls * sizeof(bool));
+  if (bowl_busy == NULL) {
+    panic("could not allocate bowl state");
   }
+  for (i = 0; i < bowls; i++) {
+    bowl_busy[i] = false;
+  }
+  eating[CAT] = eating[MOUSE] = 0;
+  waiting[CAT] = waiting[MOUSE] = 0;
+  turn = CAT;
+  batch = 0;
+  max_batch = bowls;
+  wakeups = 0;
+  useful_wakeups = 0;
   return;
 }
 
@@ -54,10 +178,21 @@ catmouse_sync_init(int bowls)
 void
 catmouse_sync_cleanup(int bowls)
 {
-  /* replace this default implementation with your own implementation of catmouse_sync_cleanup */
   (void)bowls; /* keep the compiler from complaining about unused parameters */
-  KASSERT(globalCatMouseSem != NULL);
-  sem_destroy(globalCatMouseSem);
+  KASSERT(bowl_lock != NULL);
+  KASSERT(eating[CAT] == 0 && eating[MOUSE] == 0);
+  KASSERT(waiting[CAT] == 0 && waiting[MOUSE] == 0);
+
+  if (useful_wakeups > 0) {
+    kprintf("STATS: %u wakeups for %u entries after waiting, "
+            "%u.%02u per useful entry\n", wakeups, useful_wakeups,
+            wakeups / useful_wakeups,
+            (wakeups % useful_wakeups) * 100 / useful_wakeups);
+  }
+
+  kfree(bowl_busy);
+  kcv_destroy(bowl_kcv);
+  lock_destroy(bowl_lock);
 }
 
 
@@ -76,10 +211,7 @@ catmouse_sync_cleanup(int bowls)
 void
 cat_before_eating(unsigned int bowl) 
 {
-  /* replace this default implementation with your own implementation of cat_before_eating */
-  (void)bowl;  /* keep the compiler from complaining about an unused parameter */
-  KASSERT(globalCatMouseSem != NULL);
-  P(globalCatMouseSem);
+  before_eating(CAT, bowl);
 }
 
 /*
@@ -98,10 +230,7 @@ cat_before_eating(unsigned int bowl)
 void
 cat_after_eating(unsigned int bowl) 
 {
-  /* replace this default implementation with your own implementation of cat_after_eating */
-  (void)bowl;  /* keep the compiler from complaining about an unused parameter */
-  KASSERT(globalCatMouseSem != NULL);
-  V(globalCatMouseSem);
+  after_eating(CAT, bowl);
 }
 
 /*
@@ -119,10 +248,7 @@ cat_after_eating(unsigned int bowl)
 void
 mouse_before_eating(unsigned int bowl) 
 {
-  /* replace this default implementation with your own implementation of mouse_before_eating */
-  (void)bowl;  /* keep the compiler from complaining about an unused parameter */
-  KASSERT(globalCatMouseSem != NULL);
-  P(globalCatMouseSem);
+  before_eating(MOUSE, bowl);
 }
 
 /*
@@ -141,8 +267,5 @@ mouse_before_eating(unsigned int bowl)
 void
 mouse_after_eating(unsigned int bowl) 
 {
-  /* replace this default implementation with your own implementation of mouse_after_eating */
-  (void)bowl;  /* keep the compiler from complaining about an unused parameter */
-  KASSERT(globalCatMouseSem != NULL);
-  V(globalCatMouseSem);
+  after_eating(MOUSE, bowl);
 }
@@ -83,6 +83,17 @@ static struct semaphore *mutex;
 static volatile time_t total_wait_secs[4];
 static volatile uint32_t total_wait_nsecs[4];
 static volatile int wait_count[4];
+/* longest single wait, in milliseconds, for the tail of the distribution */
+static volatile int max_wait_msecs[4];
+/* the same by kind of turn: MOVE_RIGHT, MOVE_STRAIGHT, MOVE_LEFT */
+#define MOVE_RIGHT 0
+#define MOVE_STRAIGHT 1
+#define MOVE_LEFT 2
+static volatile int move_wait_msecs[3];
+static volatile int move_count[3];
+static volatile int move_max_wait_msecs[3];
+/* most vehicles ever in the intersection at once; protected by mutex */
+static volatile int max_inside;
 /* mutex to provide mutual exclusion to performance stats */
 static struct semaphore *perf_mutex;
 
@@ -97,6 +108,7 @@ static void print_direction(Direction d);
 static void print_perf_stats(void);
 static void vehicle_simulation(void *ptr, unsigned long thread_num);
 static bool right_turn(Vehicle *v);
+static int movement(Vehicle *v);
 static void check_constraints(int thread_num);
 
 
@@ -149,6 +161,7 @@ print_perf_stats(void) {
   int i;
   int wait_msecs,mean_wait_msecs;
   int total_wait_msecs = 0;
+  int all_max_wait_msecs = 0;
   int total_count = 0;
   int sim_msec;
   time_t run_sec;
@@ -164,27 +177,46 @@ print_perf_stats(void) {
       // some rounding error here, in millisecond range
       mean_wait_msecs = wait_msecs/wait_count[i];
       total_count += wait_count[i];
-      kprintf("%d vehicles, average %d.%03d seconds waiting\n",wait_count[i], mean_wait_msecs/1000,mean_wait_msecs%1000);
+      kprintf("%d vehicles, average %d.%03d seconds waiting, max %d.%03d\n",wait_count[i], mean_wait_msecs/1000,mean_wait_msecs%1000,
+	      max_wait_msecs[i]/1000,max_wait_msecs[i]%1000);
+      if (max_wait_msecs[i] > all_max_wait_msecs) {
+	all_max_wait_msecs = max_wait_msecs[i];
+      }
     } else {
       kprintf("0 vehicles, average 0.000 seconds\n");
     }
   }
   /* then the average wait time for all vehicles */
   if (total_count > 0) {
-    kprintf("all:\t%d vehicles, average %d.%03d seconds waiting\n",total_count,
+    kprintf("all:\t%d vehicles, average %d.%03d seconds waiting, max %d.%03d\n",total_count,
 	    (total_wait_msecs/total_count)/1000,
-	    (total_wait_msecs/total_count)%1000);
+	    (total_wait_msecs/total_count)%1000,
+	    all_max_wait_msecs/1000,
+	    all_max_wait_msecs%1000);
   } else{
     kprintf("all:\t0 vehicles, average 0.000 seconds waiting\n");
   }
+  /* then by kind of turn, to show which movements get held up */
+  for(i=0;i<3;i++) {
+    kprintf("%s:\t", i == MOVE_RIGHT ? "right" : i == MOVE_STRAIGHT ? "straight" : "left");
+    if (move_count[i] > 0) {
+      mean_wait_msecs = move_wait_msecs[i]/move_count[i];
+      kprintf("%d vehicles, average %d.%03d seconds waiting, max %d.%03d\n",move_count[i],
+	      mean_wait_msecs/1000,mean_wait_msecs%1000,
+	      move_max_wait_msecs[i]/1000,move_max_wait_msecs[i]%1000);
+    } else {
+      kprintf("0 vehicles, average 0.000 seconds waiting\n");
+    }
+  }
   /* finally, overall simulation run-time and throughput */
   getinterval(start_sec,start_nsec,end_sec,end_nsec,&run_sec,&run_nsec);
   sim_msec = run_sec*1000;
   sim_msec += run_nsec/1000000;
-  kprintf("Simulation: %d.%03d seconds, %d vehicles\n",
+  kprintf("Simulation: %d.%03d seconds, %d vehicles, at most %d in the intersection at once\n",
 	  sim_msec/1000,
 	  sim_msec%1000,
-	  total_count);
+	  total_count,
+	  max_inside);
 } 
 
 
@@ -217,6 +249,31 @@ right_turn(Vehicle *v) {
 }
 
 
+/*
+ * int movement()
+ * 
+ * Purpose:
+ *   classifies a vehicle's path through the intersection
+ *
+ * Arguments:
+ *   a pointer to a Vehicle
+ *
+ * Returns:
+ *   MOVE_RIGHT, MOVE_STRAIGHT or MOVE_LEFT
+ */
+static int
+movement(Vehicle *v) {
+  KASSERT(v != NULL);
+  if (right_turn(v)) {
+    return MOVE_RIGHT;
+  } else if ((v->origin + 2) % 4 == v->destination) {
+    return MOVE_STRAIGHT;
+  } else {
+    return MOVE_LEFT;
+  }
+}
+
+
 /*
  * check_constraints()
  * 
@@ -235,7 +292,14 @@ right_turn(Vehicle *v) {
 void
 check_constraints(int thread_num) {
   int i;
+  int count = 0;
   KASSERT(thread_num < NumThreads);
+  for(i=0;i<NumThreads;i++) {
+    if (vehicles[i] != NULL) count++;
+  }
+  if (count > max_inside) {
+    max_inside = count;
+  }
   /* compare newly-added vehicle to each other vehicles in in the intersection */
   for(i=0;i<NumThreads;i++) {
     if ((i==thread_num) || (vehicles[i] == NULL)) continue;
@@ -287,7 +351,12 @@ initialize_state(void)
   }
   for(i=0;i<4;i++) {
     total_wait_secs[i] = total_wait_nsecs[i] = wait_count[i] = 0;
+    max_wait_msecs[i] = 0;
   }
+  for(i=0;i<3;i++) {
+    move_wait_msecs[i] = move_count[i] = move_max_wait_msecs[i] = 0;
+  }
+  max_inside = 0;
   mutex = sem_create("Vehicle Mutex",1);
   if (mutex == NULL) {
     panic("could not create vehicle mutex semaphore\n");
@@ -374,6 +443,7 @@ vehicle_simulation(void * unusedpointer,
   time_t before_sec, after_sec, wait_sec;
   uint32_t before_nsec, after_nsec, wait_nsec;
   int sleeptime;
+  int wait_msecs, move;
   /* avoid unused variable warnings. */
   (void) unusedpointer;
 
@@ -448,6 +518,16 @@ vehicle_simulation(void * unusedpointer,
       total_wait_secs[v.origin] ++;
     }
     wait_count[v.origin]++;
+    wait_msecs = wait_sec*1000 + wait_nsec/1000000;
+    if (wait_msecs > max_wait_msecs[v.origin]) {
+      max_wait_msecs[v.origin] = wait_msecs;
+    }
+    move = movement(&v);
+    move_wait_msecs[move] += wait_msecs;
+    move_count[move]++;
+    if (wait_msecs > move_max_wait_msecs[move]) {
+      move_max_wait_msecs[move] = wait_msecs;
+    }
     V(perf_mutex);
   }
 
@@ -21,13 +21,94 @@
 /*
  * replace this with declarations of any synchronization and other variables you need here
  */
-// static struct semaphore *intersectionSem;
+
+/*
+ * Vehicles are admitted by path, not by direction: a vehicle goes in
+ * as soon as its (origin, destination) path doesn't conflict with any
+ * path in use, so for instance right turns from different origins run
+ * together. conflicts[][] is worked out once at init from the rules.
+ *
+ * Admission alone can starve a path that keeps being crossed by a
+ * stream of others, so each waiter counts how many conflicting
+ * vehicles have gone in since it started waiting. Once that passes
+ * MAX_BYPASS it reserves the intersection: one reservation at a time,
+ * and nobody whose path conflicts with the reserved one gets in until
+ * the reserving vehicle does. Its wait is then bounded by the vehicles
+ * already inside.
+ *
+ * Waiters sleep on a keyed CV by path. When the last vehicle on a path
+ * leaves, only the paths it was blocking are woken.
+ */
+#define NPATHS 16
+#define PATH(o, d) ((o) * 4 + (d))
+#define NO_PATH (-1)
+#define MAX_BYPASS 8
+
 static struct lock *state_lock;
-static struct cv *state_cv; 
-static volatile Direction state;
-static volatile int enter_count;
-static volatile int exit_count;
-static const int MAX_COUNT = 5;
+static struct kcv *state_kcv;           /* keyed by path */
+static bool conflicts[NPATHS][NPATHS];
+static volatile int inside[NPATHS];     /* vehicles in the intersection */
+static volatile int waiting[NPATHS];
+/* vehicles let in that conflict with each path, ever */
+static volatile unsigned bypasses[NPATHS];
+static volatile int reserved_path;
+
+/* kcv_wait returns, and vehicles that got in after waiting */
+static volatile unsigned wakeups;
+static volatile unsigned useful_wakeups;
+
+static
+bool
+is_right_turn(Direction o, Direction d)
+{
+        return (o == west && d == south) || (o == south && d == east) ||
+                (o == east && d == north) || (o == north && d == west);
+}
+
+/*
+ * Can vehicles on these two paths be in the intersection together?
+ * Same rules as check_constraints in traffic.c. Paths with o == d
+ * don't exist and are never used.
+ */
+static
+bool
+paths_conflict(Direction o1, Direction d1, Direction o2, Direction d2)
+{
+        if (o1 == o2) {
+                return false;
+        }
+        if (o1 == d2 && d1 == o2) {
+                return false;
+        }
+        if ((is_right_turn(o1, d1) || is_right_turn(o2, d2)) && d1 != d2) {
+                return false;
+        }
+        return true;
+}
+
+static
+bool
+can_enter(int path)
+{
+        for (int q = 0; q < NPATHS; q++) {
+                if (inside[q] > 0 && conflicts[path][q]) {
+                        return false;
+                }
+        }
+        return reserved_path == NO_PATH || !conflicts[path][reserved_path];
+}
+
+/* Wake everybody waiting on a path that conflicts with PATH. */
+static
+void
+wake_conflicting(int path)
+{
+        for (int q = 0; q < NPATHS; q++) {
+                if (waiting[q] > 0 && conflicts[path][q]) {
+                        kcv_broadcast(state_kcv, state_lock, q);
+                }
+        }
+}
 
 
 /* 
@@ -40,26 +121,28 @@ static const int MAX_COUNT = 5;
 void
 intersection_sync_init(void)
 {
-  /* replace this default implementation with your own implementation */
-
-/*
-  intersectionSem = sem_create("intersectionSem",1);
-  if (intersectionSem == NULL) {
-    panic("could not create intersection semaphore");
-  }
-  return;
-*/
         state_lock = lock_create("state_lock");
         if (state_lock == NULL) {
                 panic("could not create state lock");
         } 
-        state_cv = cv_create("state_cv");
-        if (state_cv == NULL) {
-                panic("could not create state cv");
+        // hand the lock over in arrival order to bound the worst-case wait
+        lock_setfifo(state_lock);
+        state_kcv = kcv_create("state_kcv", NPATHS);
+        if (state_kcv == NULL) {
+                panic("could not create state kcv");
+        }
+        for (int p = 0; p < NPATHS; p++) {
+                for (int q = 0; q < NPATHS; q++) {
+                        conflicts[p][q] = paths_conflict(p / 4, p % 4,
+                                                         q / 4, q % 4);
+                }
+                inside[p] = 0;
+                waiting[p] = 0;
+                bypasses[p] = 0;
         }
-        state = north;
-        enter_count = 0;
-        exit_count = 0;
+        reserved_path = NO_PATH;
+        wakeups = 0;
+        useful_wakeups = 0;
 }
 
 /* 
@@ -72,15 +155,16 @@ intersection_sync_init(void)
 void
 intersection_sync_cleanup(void)
 {
-  /* replace this default implementation with your own implementation */
-/*
-  KASSERT(intersectionSem != NULL);
-  sem_destroy(intersectionSem);
-*/
-        
         KASSERT(state_lock != NULL);
+        KASSERT(reserved_path == NO_PATH);
+        if (useful_wakeups > 0) {
+                kprintf("STATS: %u wakeups for %u entries after waiting, "
+                        "%u.%02u per useful entry\n", wakeups, useful_wakeups,
+                        wakeups / useful_wakeups,
+                        (wakeups % useful_wakeups) * 100 / useful_wakeups);
+        }
         lock_destroy(state_lock);
-        cv_destroy(state_cv);
+        kcv_destroy(state_kcv);
 }
 
 
@@ -100,29 +184,42 @@ intersection_sync_cleanup(void)
 void
 intersection_before_entry(Direction origin, Direction destination) 
 {
-  /* replace this default implementation with your own implementation */
-  // (void)origin;  /* avoid compiler complaint about unused parameter */
-  (void)destination; /* avoid compiler complaint about unused parameter */
-/*
-  KASSERT(intersectionSem != NULL);
-  P(intersectionSem);
-*/
+        int path = PATH(origin, destination);
+        unsigned start;
+        bool waited = false;
+        bool reserving = false;
+
         lock_acquire(state_lock);
-        bool occupied = (enter_count != exit_count);
-        while (occupied && (state != origin || enter_count >= MAX_COUNT)) {
-                DEBUG(DB_THREADS, "Waiting for state change to allow %d to %d.\n", origin, destination);
-                cv_wait(state_cv, state_lock);
-                occupied = (enter_count != exit_count);
+        start = bypasses[path];
+        while (!can_enter(path)) {
+                if (!reserving && reserved_path == NO_PATH &&
+                    bypasses[path] - start >= MAX_BYPASS) {
+                        DEBUG(DB_THREADS, "Reserving intersection for %d to %d.\n", origin, destination);
+                        reserving = true;
+                        reserved_path = path;
+                }
+                DEBUG(DB_THREADS, "Waiting to go from %d to %d.\n", origin, destination);
+                waiting[path]++;
+                kcv_wait(state_kcv, state_lock, path);
+                waiting[path]--;
+                wakeups++;
+                waited = true;
+        }
+        if (waited) {
+                useful_wakeups++;
         }
-        if (!occupied && state != origin) {
-                DEBUG(DB_THREADS, "Intersection is empty, changing state from %d to %d.\n", state, origin);
-                enter_count = 0;
-                exit_count = 0;
-                state = origin;
-                // cv_broadcast(state_cv, state_lock);
+        if (reserving) {
+                KASSERT(reserved_path == path);
+                reserved_path = NO_PATH;
+                wake_conflicting(path);
         }
         DEBUG(DB_THREADS, "Entering intersection from %d to %d.\n", origin, destination);
-        enter_count ++; 
+        inside[path]++;
+        for (int q = 0; q < NPATHS; q++) {
+                if (conflicts[path][q]) {
+                        bypasses[q]++;
+                }
+        }
         lock_release(state_lock);
 }
 
@@ -141,18 +238,14 @@ intersection_before_entry(Direction origin, Direction destination)
 void
 intersection_after_exit(Direction origin, Direction destination) 
 {
-  /* replace this default implementation with your own implementation */
-  (void)origin;  /* avoid compiler complaint about unused parameter */
-  (void)destination; /* avoid compiler complaint about unused parameter */
-/*
-  KASSERT(intersectionSem != NULL);
-  V(intersectionSem);
-*/
+        int path = PATH(origin, destination);
+
         lock_acquire(state_lock);
-        DEBUG(DB_THREADS, "Leaving intersection.\n");
-        exit_count ++;
-        if (exit_count == enter_count) {
-                cv_broadcast(state_cv, state_lock);
+        DEBUG(DB_THREADS, "Leaving intersection from %d to %d.\n", origin, destination);
+        KASSERT(inside[path] > 0);
+        inside[path]--;
+        if (inside[path] == 0) {
+                wake_conflicting(path);
         }
-        lock_release(state_lock);        
+        lock_release(state_lock);
 }
@@ -1,6 +1,11 @@
+#include "opt-A2.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <uio.h>
 #include <syscall.h>
@@ -8,6 +13,669 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <limits.h>
+#include <filetable.h>
+#include <poll.h>
+
+#if OPT_A2
+/*
+ * File system calls on top of the per-process filetable (see
+ * filetable.h). Descriptors shared by dup2 or fork share the seek
+ * position; each read, write or lseek holds the openfile's lock so
+ * they see and move it one at a time. The positional calls (pread and
+ * friends) leave the position and the lock alone.
+ */
+
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+    struct openfile *of;
+    char *path;
+    int result;
+
+    switch (flags & O_ACCMODE) {
+      case O_RDONLY:
+      case O_WRONLY:
+      case O_RDWR:
+        break;
+      default:
+        return(EINVAL);
+    }
+
+    path = kmalloc(PATH_MAX);
+    if (path == NULL) {
+        return(ENOMEM);
+    }
+    result = copyinstr(upath, path, PATH_MAX, NULL);
+    if (result == 0) {
+        result = openfile_open(path, flags, mode, &of);
+    }
+    kfree(path);
+    if (result) {
+        return(result);
+    }
+
+    result = filetable_place(curproc->p_files, of, retval);
+    if (result) {
+        openfile_decref(of);
+    }
+    return(result);
+}
+
+int
+sys_close(int fd)
+{
+    struct openfile *of;
+    int result;
+
+    result = filetable_remove(curproc->p_files, fd, &of);
+    if (result) {
+        return(result);
+    }
+    openfile_decref(of);
+    return(0);
+}
+
+int
+sys_pipe(userptr_t ufds, int *retval)
+{
+    struct openfile *rof, *wof, *junk;
+    int fds[2];
+    int result;
+
+    result = openfile_pipe(&rof, &wof);
+    if (result) {
+        return(result);
+    }
+    result = filetable_place(curproc->p_files, rof, &fds[0]);
+    if (result) {
+        openfile_decref(rof);
+        openfile_decref(wof);
+        return(result);
+    }
+    result = filetable_place(curproc->p_files, wof, &fds[1]);
+    if (result) {
+        openfile_decref(wof);
+        goto fail;
+    }
+
+    result = copyout(fds, ufds, sizeof(fds));
+    if (result) {
+        if (filetable_remove(curproc->p_files, fds[1], &junk) == 0) {
+            openfile_decref(junk);
+        }
+        goto fail;
+    }
+    *retval = 0;
+    return(0);
+
+fail:
+    // another thread may have closed it already; if so, that's fine
+    if (filetable_remove(curproc->p_files, fds[0], &junk) == 0) {
+        openfile_decref(junk);
+    }
+    return(result);
+}
+
+/*
+ * Do the transfer described by U (all but its offset) on the file at
+ * FD. If POSITIONAL, do it at U's offset as given, without touching
+ * the file's seek position or taking its lock; otherwise do it at the
+ * seek position and advance that by the amount moved.
+ */
+static
+int
+file_io(int fd, struct uio *u, bool positional, int *retval)
+{
+    struct openfile *of;
+    struct stat st;
+    size_t nbytes = u->uio_resid;
+    int accmode;
+    int result;
+
+    result = filetable_get(curproc->p_files, fd, &of);
+    if (result) {
+        return(result);
+    }
+
+    accmode = of->of_flags & O_ACCMODE;
+    if (accmode == (u->uio_rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+        openfile_decref(of);
+        return(EBADF);
+    }
+
+    if (positional) {
+        // ESPIPE for the console and the like
+        result = VOP_TRYSEEK(of->of_vnode, u->uio_offset);
+        if (result) {
+            openfile_decref(of);
+            return(result);
+        }
+    } else {
+        lock_acquire(of->of_lock);
+        if (u->uio_rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+            result = VOP_STAT(of->of_vnode, &st);
+            if (result) {
+                goto out;
+            }
+            of->of_offset = st.st_size;
+        }
+        u->uio_offset = of->of_offset;
+    }
+
+    if (u->uio_rw == UIO_READ) {
+        result = VOP_READ(of->of_vnode, u);
+    } else {
+        result = VOP_WRITE(of->of_vnode, u);
+    }
+    if (result == 0) {
+        if (!positional) {
+            of->of_offset = u->uio_offset;
+        }
+        *retval = nbytes - u->uio_resid;
+    }
+out:
+    if (!positional) {
+        lock_release(of->of_lock);
+    }
+    openfile_decref(of);
+    return(result);
+}
+
+/*
+ * Set up U and IOV for a transfer of NBYTES to or from UBUF.
+ */
+static
+void
+file_uinit(struct iovec *iov, struct uio *u, userptr_t ubuf, size_t nbytes,
+        enum uio_rw rw)
+{
+    iov->iov_ubase = ubuf;
+    iov->iov_len = nbytes;
+    u->uio_iov = iov;
+    u->uio_iovcnt = 1;
+    u->uio_offset = 0;
+    u->uio_resid = nbytes;
+    u->uio_segflg = UIO_USERSPACE;
+    u->uio_rw = rw;
+    u->uio_space = curproc_getas();
+}
+
+/*
+ * Number of iovecs readv and friends take without going to kmalloc
+ * for somewhere to put them.
+ */
+#define FILE_SMALLIOV 8
+
+/*
+ * Set up U for a transfer to or from the IOVCNT buffers described by
+ * the user iovec array UIOV, which is copied straight into the uio's
+ * iovec array: SMALL if it fits, or else a kmalloc'd one that the
+ * caller frees with file_uvfree.
+ */
+static
+int
+file_uvinit(struct iovec *small, struct uio *u, userptr_t uiov, int iovcnt,
+        enum uio_rw rw)
+{
+    struct iovec *iov;
+    size_t len;
+    int i;
+    int result;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        return(EINVAL);
+    }
+    if (iovcnt <= FILE_SMALLIOV) {
+        iov = small;
+    } else {
+        iov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (iov == NULL) {
+            return(ENOMEM);
+        }
+    }
+
+    // the kernel and user iovecs are laid out the same way
+    result = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+    if (result) {
+        goto fail;
+    }
+
+    // the total has to fit in the return value
+    len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t)0x7fffffff - len) {
+            result = EINVAL;
+            goto fail;
+        }
+        len += iov[i].iov_len;
+    }
+
+    u->uio_iov = iov;
+    u->uio_iovcnt = iovcnt;
+    u->uio_offset = 0;
+    u->uio_resid = len;
+    u->uio_segflg = UIO_USERSPACE;
+    u->uio_rw = rw;
+    u->uio_space = curproc_getas();
+    return(0);
+
+fail:
+    if (iov != small) {
+        kfree(iov);
+    }
+    return(result);
+}
+
+static
+void
+file_uvfree(struct iovec *small, struct uio *u)
+{
+    if (u->uio_iov != small) {
+        kfree(u->uio_iov);
+    }
+}
+
+int
+sys_read(int fd, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+    struct iovec iov;
+    struct uio u;
+
+    file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+    return(file_io(fd, &u, false, retval));
+}
+
+int
+sys_write(int fd, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+    struct iovec iov;
+    struct uio u;
+
+    DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fd,(unsigned int)ubuf,nbytes);
+    file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+    return(file_io(fd, &u, false, retval));
+}
+
+/*
+ * The positional calls: these don't use or move the seek position,
+ * so threads sharing a file don't queue up on its lock.
+ */
+int
+sys_pread(int fd, userptr_t ubuf, unsigned int nbytes, off_t pos,
+        int *retval)
+{
+    struct iovec iov;
+    struct uio u;
+
+    if (pos < 0) {
+        return(EINVAL);
+    }
+    file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+    u.uio_offset = pos;
+    return(file_io(fd, &u, true, retval));
+}
+
+int
+sys_pwrite(int fd, userptr_t ubuf, unsigned int nbytes, off_t pos,
+        int *retval)
+{
+    struct iovec iov;
+    struct uio u;
+
+    if (pos < 0) {
+        return(EINVAL);
+    }
+    file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+    u.uio_offset = pos;
+    return(file_io(fd, &u, true, retval));
+}
+
+/*
+ * The vectored calls. POS is -1 for readv and writev, which use the
+ * seek position.
+ */
+static
+int
+file_iov(int fd, userptr_t uiov, int iovcnt, off_t pos, enum uio_rw rw,
+        int *retval)
+{
+    struct iovec small[FILE_SMALLIOV];
+    struct uio u;
+    int result;
+
+    result = file_uvinit(small, &u, uiov, iovcnt, rw);
+    if (result) {
+        return(result);
+    }
+    u.uio_offset = pos;
+    result = file_io(fd, &u, pos >= 0, retval);
+    file_uvfree(small, &u);
+    return(result);
+}
+
+int
+sys_readv(int fd, userptr_t uiov, int iovcnt, int *retval)
+{
+    return(file_iov(fd, uiov, iovcnt, -1, UIO_READ, retval));
+}
+
+int
+sys_writev(int fd, userptr_t uiov, int iovcnt, int *retval)
+{
+    return(file_iov(fd, uiov, iovcnt, -1, UIO_WRITE, retval));
+}
+
+int
+sys_preadv(int fd, userptr_t uiov, int iovcnt, off_t pos, int *retval)
+{
+    if (pos < 0) {
+        return(EINVAL);
+    }
+    return(file_iov(fd, uiov, iovcnt, pos, UIO_READ, retval));
+}
+
+int
+sys_pwritev(int fd, userptr_t uiov, int iovcnt, off_t pos, int *retval)
+{
+    if (pos < 0) {
+        return(EINVAL);
+    }
+    return(file_iov(fd, uiov, iovcnt, pos, UIO_WRITE, retval));
+}
+
+int
+sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+    struct openfile *of;
+    struct stat st;
+    off_t newpos;
+    int result;
+
+    result = filetable_get(curproc->p_files, fd, &of);
+    if (result) {
+        return(result);
+    }
+
+    lock_acquire(of->of_lock);
+    switch (whence) {
+      case SEEK_SET:
+        newpos = pos;
+        break;
+      case SEEK_CUR:
+        newpos = of->of_offset + pos;
+        break;
+      case SEEK_END:
+        result = VOP_STAT(of->of_vnode, &st);
+        if (result) {
+            goto out;
+        }
+        newpos = st.st_size + pos;
+        break;
+      default:
+        result = EINVAL;
+        goto out;
+    }
+    if (newpos < 0) {
+        result = EINVAL;
+        goto out;
+    }
+
+    // ESPIPE for the console and the like
+    result = VOP_TRYSEEK(of->of_vnode, newpos);
+    if (result == 0) {
+        of->of_offset = newpos;
+        *retval = newpos;
+    }
+out:
+    lock_release(of->of_lock);
+    openfile_decref(of);
+    return(result);
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+    struct openfile *of, *old;
+    int result;
+
+    if (newfd < 0 || newfd >= OPEN_MAX) {
+        return(EBADF);
+    }
+    result = filetable_get(curproc->p_files, oldfd, &of);
+    if (result) {
+        return(result);
+    }
+
+    if (oldfd == newfd) {
+        openfile_decref(of);
+    } else {
+        // our reference from filetable_get goes into the table
+        filetable_replace(curproc->p_files, newfd, of, &old);
+        if (old != NULL) {
+            openfile_decref(old);
+        }
+    }
+
+    *retval = newfd;
+    return(0);
+}
+
+/*
+ * Fill in the revents of the NFDS pollfds in FDS, waiting up to
+ * TIMEOUT_MS milliseconds (forever if negative) for one of them to
+ * have something to report, and set *RETVAL to how many do.
+ *
+ * The first pass asks every file and leaves a pollent on each; after
+ * that, a wakeup means looking again only at the files whose pollents
+ * fired, however many descriptors there are. References to the files
+ * are kept until the pollents are off them.
+ */
+static
+int
+file_poll(struct pollfd *fds, unsigned nfds, int timeout_ms, int *retval)
+{
+    struct openfile **ofs;
+    struct poller *pl;
+    unsigned i, nready;
+    int revents, result = 0;
+
+    ofs = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct openfile *));
+    if (ofs == NULL) {
+        return(ENOMEM);
+    }
+    pl = poller_create(nfds);
+    if (pl == NULL) {
+        kfree(ofs);
+        return(ENOMEM);
+    }
+
+    nready = 0;
+    for (i = 0; i < nfds; i++) {
+        ofs[i] = NULL;
+        fds[i].revents = 0;
+        if (fds[i].fd < 0) {
+            continue;
+        }
+        if (filetable_get(curproc->p_files, fds[i].fd, &ofs[i])) {
+            fds[i].revents = POLLNVAL;
+            nready++;
+            continue;
+        }
+        result = VOP_POLL(ofs[i]->of_vnode, fds[i].events,
+                poller_ent(pl, i), &revents);
+        if (result) {
+            goto out;
+        }
+        fds[i].revents = revents;
+        if (revents != 0) {
+            nready++;
+        }
+    }
+
+    if (nready == 0) {
+        poller_settimeout(pl, timeout_ms);
+        while (nready == 0 && poller_wait(pl) == 0) {
+            while (poller_next(pl, &i)) {
+                result = VOP_POLL(ofs[i]->of_vnode, fds[i].events, NULL,
+                        &revents);
+                if (result) {
+                    goto out;
+                }
+                fds[i].revents = revents;
+                if (revents != 0) {
+                    nready++;
+                }
+            }
+        }
+    }
+    *retval = nready;
+
+out:
+    poller_destroy(pl);
+    for (i = 0; i < nfds; i++) {
+        if (ofs[i] != NULL) {
+            openfile_decref(ofs[i]);
+        }
+    }
+    kfree(ofs);
+    return(result);
+}
+
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+    struct pollfd *fds;
+    int result;
+
+    if (nfds > OPEN_MAX) {
+        return(EINVAL);
+    }
+    fds = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct pollfd));
+    if (fds == NULL) {
+        return(ENOMEM);
+    }
+    result = copyin(ufds, fds, nfds * sizeof(struct pollfd));
+    if (result == 0) {
+        result = file_poll(fds, nfds, timeout, retval);
+    }
+    if (result == 0) {
+        result = copyout(fds, ufds, nfds * sizeof(struct pollfd));
+    }
+    kfree(fds);
+    return(result);
+}
+
+/*
+ * select is poll with the descriptors in bitmaps: make a pollfd for
+ * each descriptor in any of the sets, then turn what comes back into
+ * bits again. A descriptor that isn't open is EBADF.
+ */
+int
+sys_select(int nfds, userptr_t ureadfds, userptr_t uwritefds,
+        userptr_t uexceptfds, userptr_t utimeout, int *retval)
+{
+    fd_set sets[3];
+    userptr_t usets[3] = { ureadfds, uwritefds, uexceptfds };
+    static const short setevents[3] = { POLLIN, POLLOUT, POLLPRI };
+    static const short setrevents[3] = {
+        POLLIN | POLLHUP | POLLERR, POLLOUT | POLLERR, POLLPRI
+    };
+    struct pollfd *fds;
+    struct timeval tv;
+    unsigned npfds, i, s;
+    int fd, timeout, nready, result;
+
+    if (nfds < 0 || nfds > FD_SETSIZE) {
+        return(EINVAL);
+    }
+
+    for (s = 0; s < 3; s++) {
+        FD_ZERO(&sets[s]);
+        if (usets[s] != NULL) {
+            result = copyin(usets[s], &sets[s], sizeof(fd_set));
+            if (result) {
+                return(result);
+            }
+        }
+    }
+
+    timeout = -1;
+    if (utimeout != NULL) {
+        result = copyin(utimeout, &tv, sizeof(tv));
+        if (result) {
+            return(result);
+        }
+        if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+            return(EINVAL);
+        }
+        // round up, so a short timeout doesn't become a poll
+        if (tv.tv_sec >= 0x7fffffff / 1000 - 1) {
+            timeout = 0x7fffffff;
+        } else {
+            timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+        }
+    }
+
+    fds = kmalloc((nfds > 0 ? nfds : 1) * sizeof(struct pollfd));
+    if (fds == NULL) {
+        return(ENOMEM);
+    }
+    npfds = 0;
+    for (fd = 0; fd < nfds; fd++) {
+        fds[npfds].fd = fd;
+        fds[npfds].events = 0;
+        for (s = 0; s < 3; s++) {
+            if (FD_ISSET(fd, &sets[s])) {
+                fds[npfds].events |= setevents[s];
+            }
+        }
+        if (fds[npfds].events != 0) {
+            npfds++;
+        }
+    }
+
+    result = file_poll(fds, npfds, timeout, &nready);
+    if (result) {
+        goto out;
+    }
+
+    for (s = 0; s < 3; s++) {
+        FD_ZERO(&sets[s]);
+    }
+    nready = 0;
+    for (i = 0; i < npfds; i++) {
+        if (fds[i].revents & POLLNVAL) {
+            result = EBADF;
+            goto out;
+        }
+        for (s = 0; s < 3; s++) {
+            if ((fds[i].events & setevents[s]) &&
+                (fds[i].revents & setrevents[s])) {
+                FD_SET(fds[i].fd, &sets[s]);
+                nready++;
+            }
+        }
+    }
+
+    for (s = 0; s < 3; s++) {
+        if (usets[s] != NULL) {
+            result = copyout(&sets[s], usets[s], sizeof(fd_set));
+            if (result) {
+                goto out;
+            }
+        }
+    }
+    *retval = nready;
+
+out:
+    kfree(fds);
+    return(result);
+}
+
+#else /* OPT_A2 */
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +726,5 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+
+#endif /* OPT_A2 */
@@ -0,0 +1,174 @@
+#include "opt-A2.h"
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/ioring.h>
+#include <lib.h>
+#include <syscall.h>
+#include <copyinout.h>
+
+/*
+ * Batched system calls; see kern/ioring.h.
+ *
+ * The ring is plain user memory, so it's read and written with
+ * copyin/copyout like any other system call argument: one copy for
+ * the counters, one (or two, if they wrap) per IORING_CHUNK submissions,
+ * the same for the completions. The entries run here, in order, on the
+ * calling thread, through the same sys_* functions the traps use, so
+ * a batch costs one trap and a handful of copies however many calls
+ * are in it.
+ */
+
+#if OPT_A2
+#define IORING_SLOT(i) ((i) % IORING_ENTRIES)
+#define IORING_CHUNK 16             // entries copied at a time
+
+/*
+ * Copy N ring entries of SIZE bytes each between KBUF and the user
+ * array UARRAY, starting at slot FIRST and wrapping around the end.
+ */
+static
+int
+ioring_copy(userptr_t uarray, void *kbuf, size_t size, unsigned first,
+        unsigned n, bool out)
+{
+    unsigned start, n1;
+    int result;
+
+    start = IORING_SLOT(first);
+    n1 = n < IORING_ENTRIES - start ? n : IORING_ENTRIES - start;
+    if (out) {
+        result = copyout(kbuf, uarray + start * size, n1 * size);
+    } else {
+        result = copyin(uarray + start * size, kbuf, n1 * size);
+    }
+    if (result || n1 == n) {
+        return(result);
+    }
+    if (out) {
+        return(copyout((char *) kbuf + n1 * size, uarray, (n - n1) * size));
+    }
+    return(copyin(uarray, (char *) kbuf + n1 * size, (n - n1) * size));
+}
+
+/*
+ * Run one submission. Returns false if it has IORING_F_STOP and fell
+ * short, so nothing after it should run yet.
+ */
+static
+bool
+ioring_run(const struct ioring_sqe *sqe, struct ioring_cqe *cqe)
+{
+    int retval = 0;
+    pid_t pid;
+    off_t pos = 0;
+
+    cqe->cqe_data = sqe->sqe_data;
+    switch (sqe->sqe_op) {
+      case IORING_OP_NOP:
+        cqe->cqe_errno = 0;
+        break;
+      case IORING_OP_READ:
+        cqe->cqe_errno = sys_read(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+                &retval);
+        pos = retval;
+        break;
+      case IORING_OP_WRITE:
+        cqe->cqe_errno = sys_write(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len,
+                &retval);
+        pos = retval;
+        break;
+      case IORING_OP_LSEEK:
+        cqe->cqe_errno = sys_lseek(sqe->sqe_fd, sqe->sqe_off,
+                sqe->sqe_whence, &pos);
+        break;
+      case IORING_OP_GETPID:
+        cqe->cqe_errno = sys_getpid(&pid);
+        pos = pid;
+        break;
+      default:
+        cqe->cqe_errno = ENOSYS;
+        break;
+    }
+    cqe->cqe_result = cqe->cqe_errno ? -1 : pos;
+
+    if ((sqe->sqe_flags & IORING_F_STOP) == 0) {
+        return(true);
+    }
+    if (cqe->cqe_errno) {
+        return(false);
+    }
+    if (sqe->sqe_op == IORING_OP_READ || sqe->sqe_op == IORING_OP_WRITE) {
+        return(cqe->cqe_result == sqe->sqe_len);
+    }
+    return(true);
+}
+
+int
+sys_ioring_enter(userptr_t uring, unsigned tosubmit, int *retval)
+{
+    struct ioring *ring = (struct ioring *) uring;
+    struct ioring_sqe sq[IORING_CHUNK];
+    struct ioring_cqe cq[IORING_CHUNK];
+    __u32 ctr[4];                   // sqhead, sqtail, cqhead, cqtail
+    unsigned n, done, chunk, i;
+    bool stop = false;
+    int result;
+
+    result = copyin(uring, ctr, sizeof(ctr));
+    if (result) {
+        return(result);
+    }
+
+    // what's been submitted, what was asked for, and what there's room for
+    n = ctr[1] - ctr[0];
+    if (n > IORING_ENTRIES || ctr[3] - ctr[2] > IORING_ENTRIES) {
+        return(EINVAL);
+    }
+    if (n > tosubmit) {
+        n = tosubmit;
+    }
+    if (n > IORING_ENTRIES - (ctr[3] - ctr[2])) {
+        n = IORING_ENTRIES - (ctr[3] - ctr[2]);
+    }
+
+    for (done = 0; done < n && !stop; done += chunk) {
+        chunk = n - done < IORING_CHUNK ? n - done : IORING_CHUNK;
+        result = ioring_copy((userptr_t) ring->ir_sq, sq, sizeof(sq[0]),
+                ctr[0] + done, chunk, false);
+        if (result) {
+            break;
+        }
+        for (i = 0; i < chunk && !stop; i++) {
+            stop = !ioring_run(&sq[i], &cq[i]);
+        }
+        // only what ran gets a completion; the rest stays queued
+        chunk = i;
+        result = ioring_copy((userptr_t) ring->ir_cq, cq, sizeof(cq[0]),
+                ctr[3] + done, chunk, true);
+        if (result) {
+            // they ran, even if nobody hears about it
+            done += chunk;
+            break;
+        }
+    }
+
+    /*
+     * Completions first, then the counters that cover them. If a copy
+     * failed partway, the counters still cover everything that ran, so
+     * nothing is run twice.
+     */
+    if (done > 0) {
+        ctr[0] += done;
+        ctr[3] += done;
+        if (copyout(&ctr[0], (userptr_t) &ring->ir_sqhead, sizeof(ctr[0])) ||
+            copyout(&ctr[3], (userptr_t) &ring->ir_cqtail, sizeof(ctr[3]))) {
+            return(EFAULT);
+        }
+    }
+    if (result) {
+        return(result);
+    }
+    *retval = done;
+    return(0);
+}
+#endif /* OPT_A2 */
@@ -57,9 +57,195 @@
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
+#include <spinlock.h>
 #include <vnode.h>
 #include <elf.h>
 
+/*
+ * Cache of parsed executable headers.
+ *
+ * Running the same program over and over (as farm and hogparty do)
+ * would otherwise read and check the ELF header and every program
+ * header twice per exec. Instead we keep, for the last few
+ * executables loaded, the entry point and the PT_LOAD segments, and
+ * go straight to loading the segments.
+ *
+ * Each entry holds a reference to its vnode. Exec closes the file once
+ * it's loaded, so without that the vnode would be reclaimed, and the
+ * next exec of the same program would get a new one and never match.
+ * The reference keeps the vnode, and its vn_writegen, which changes
+ * whenever the file is written or truncated, around; an entry whose
+ * generation is stale just never matches again and ages out.
+ *
+ * The references are dropped when entries are replaced, and for a
+ * whole filesystem by elfcache_purge, which vfs_unmount calls so the
+ * cache doesn't keep the filesystem busy. Until then a removed
+ * executable's blocks stay allocated, as if it were still open.
+ */
+
+/* Number of executables remembered. */
+#define ELFCACHE_SIZE		8
+
+/* Most PT_LOAD segments we handle; normally there are two or three. */
+#define ELFCACHE_MAXSEGS	8
+
+struct elf_segment {
+	off_t es_offset;	/* position in the file */
+	vaddr_t es_vaddr;	/* where it goes in memory */
+	size_t es_memsz;	/* size in memory */
+	size_t es_filesz;	/* size in the file */
+	uint32_t es_flags;	/* PF_R, PF_W, PF_X */
+};
+
+struct elf_image {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elf_segment ei_segs[ELFCACHE_MAXSEGS];
+};
+
+struct elfcache_entry {
+	struct vnode *ec_vnode;	/* referenced; NULL if the slot is empty */
+	unsigned ec_writegen;	/* vn_writegen when it was parsed */
+	unsigned ec_lastuse;	/* for replacement */
+	struct elf_image ec_image;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+static unsigned elfcache_hits, elfcache_misses;
+
+/*
+ * Look V up in the cache; if it's there as of WRITEGEN, copy its
+ * image to IMG and return true.
+ */
+static
+bool
+elfcache_lookup(struct vnode *v, unsigned writegen, struct elf_image *img)
+{
+	struct elfcache_entry *ec;
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vnode == v && ec->ec_writegen == writegen) {
+			ec->ec_lastuse = ++elfcache_clock;
+			*img = ec->ec_image;
+			elfcache_hits++;
+			spinlock_release(&elfcache_lock);
+			return true;
+		}
+	}
+	elfcache_misses++;
+	spinlock_release(&elfcache_lock);
+	return false;
+}
+
+/*
+ * Remember IMG as V's image as of WRITEGEN, replacing any older entry
+ * for V or else the least recently used one.
+ */
+static
+void
+elfcache_insert(struct vnode *v, unsigned writegen,
+		const struct elf_image *img)
+{
+	struct elfcache_entry *ec, *victim;
+	struct vnode *old;
+	unsigned i;
+
+	/* VOP_INCREF and VOP_DECREF can sleep; not under the spinlock */
+	VOP_INCREF(v);
+
+	spinlock_acquire(&elfcache_lock);
+	victim = &elfcache[0];
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vnode == v) {
+			victim = ec;
+			break;
+		}
+		if (ec->ec_lastuse < victim->ec_lastuse) {
+			victim = ec;
+		}
+	}
+	old = victim->ec_vnode;
+	victim->ec_vnode = v;
+	victim->ec_writegen = writegen;
+	victim->ec_lastuse = ++elfcache_clock;
+	victim->ec_image = *img;
+	spinlock_release(&elfcache_lock);
+
+	/* the entry's old reference (possibly to V itself) */
+	if (old != NULL) {
+		VOP_DECREF(old);
+	}
+}
+
+/*
+ * Forget every cached executable on FS, dropping the references.
+ */
+void
+elfcache_purge(struct fs *fs)
+{
+	struct vnode *drop[ELFCACHE_SIZE];
+	unsigned i, n;
+
+	n = 0;
+	spinlock_acquire(&elfcache_lock);
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode != NULL &&
+		    elfcache[i].ec_vnode->vn_fs == fs) {
+			drop[n++] = elfcache[i].ec_vnode;
+			elfcache[i].ec_vnode = NULL;
+			elfcache[i].ec_lastuse = 0;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	for (i = 0; i < n; i++) {
+		VOP_DECREF(drop[i]);
+	}
+}
+
+/*
+ * The "ec" menu command: print the hit and miss counts, or with
+ * "reset", clear them.
+ */
+int
+elfcache_cmd(int nargs, char **args)
+{
+	unsigned hits, misses, used, i;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		spinlock_acquire(&elfcache_lock);
+		elfcache_hits = elfcache_misses = 0;
+		spinlock_release(&elfcache_lock);
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: ec [reset]\n");
+		return EINVAL;
+	}
+
+	used = 0;
+	spinlock_acquire(&elfcache_lock);
+	hits = elfcache_hits;
+	misses = elfcache_misses;
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode != NULL) {
+			used++;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+
+	kprintf("ELF header cache: %u of %u entries in use\n",
+		used, ELFCACHE_SIZE);
+	kprintf("  %u hits, %u misses\n", hits, misses);
+	return 0;
+}
+
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -146,21 +332,19 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Read and check the headers of the executable V, and fill in IMG
+ * with its entry point and loadable segments.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+read_headers(struct vnode *v, struct elf_image *img)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = curproc_getas();
+	struct elf_segment *es;
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -203,12 +387,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and note the loadable ones.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
+	 * conceivably be more. We don't support more than
+	 * ELFCACHE_MAXSEGS of them.
 	 *
 	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is 
 	 * mandated by the ELF standard - we use sizeof(ph) to load,
@@ -217,6 +401,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	img->ei_entry = eh.e_entry;
+	img->ei_nsegs = 0;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -243,11 +429,63 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (img->ei_nsegs == ELFCACHE_MAXSEGS) {
+			kprintf("loadelf: more than %d segments\n",
+				ELFCACHE_MAXSEGS);
+			return ENOEXEC;
+		}
+		es = &img->ei_segs[img->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsz = ph.p_memsz;
+		es->es_filesz = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+	}
+
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elf_image img;
+	struct elf_segment *es;
+	struct addrspace *as;
+	unsigned writegen, i;
+	int result;
+
+	as = curproc_getas();
+
+	/*
+	 * Get the headers from the cache if we can. Take the write
+	 * generation before reading anything, so that if the file
+	 * changes while we read it what we cache is already stale.
+	 */
+	writegen = v->vn_writegen;
+	if (!elfcache_lookup(v, writegen, &img)) {
+		result = read_headers(v, &img);
+		if (result) {
+			return result;
+		}
+		elfcache_insert(v, writegen, &img);
+	}
+
+	/*
+	 * Set up the address space.
+	 */
+
+	for (i=0; i<img.ei_nsegs; i++) {
+		es = &img.ei_segs[i];
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  es->es_vaddr, es->es_memsz,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -262,35 +500,11 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
-		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	for (i=0; i<img.ei_nsegs; i++) {
+		es = &img.ei_segs[i];
+		result = load_segment(as, v, es->es_offset, es->es_vaddr, 
+				      es->es_memsz, es->es_filesz,
+				      es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -301,7 +515,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = img.ei_entry;
 
 	return 0;
 }
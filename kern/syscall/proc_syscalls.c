@@ -1,8 +1,11 @@
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
@@ -12,8 +15,11 @@
 #include <copyinout.h>
 #include <mips/trapframe.h>
 #include <pid.h>
+#include <filetable.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <synch.h>
+#include <limits.h>
 
   /* this implementation of sys__exit does not do anything with the exit code */
   /* this needs to be fixed to get exit() and waitpid() working properly */
@@ -22,7 +28,18 @@ void sys__exit(int exitcode) {
 
   struct addrspace *as;
   struct proc *p = curproc;
+#if OPT_A3
+  // get rid of any other user threads first (if one of them is
+  // already at it, it's waiting for us, so just leave)
+  if (proc_uthread_killothers()) {
+    proc_uthread_checkexit();
+    panic("proc_uthread_checkexit returned\n");
+  }
+#endif /* OPT_A3 */
 #if OPT_A2
+  // close our files before anyone hears we're gone
+  filetable_destroy(p->p_files);
+  p->p_files = NULL;
   // set exit code in pid table
   pid_exit(exitcode);
 #else
@@ -33,7 +50,9 @@ void sys__exit(int exitcode) {
 
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
+#if !OPT_A2
   KASSERT(curproc->p_addrspace != NULL);
+#endif /* !OPT_A2 */
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -43,7 +62,15 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
+#if OPT_A2
+  // a vfork child gives its parent's address space back instead, and
+  // a spawned child that failed early may not have one at all
+  if (!proc_vfork_release() && as != NULL) {
+    as_destroy(as);
+  }
+#else
   as_destroy(as);
+#endif /* OPT_A2 */
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -83,6 +110,9 @@ sys_waitpid(pid_t pid,
 {
   int exitstatus;
   int result;
+#if OPT_A2
+  pid_t reaped;
+#endif /* OPT_A2 */
 
   /* this is just a stub implementation that always reports an
      exit status of 0, regardless of the actual exit status of
@@ -93,17 +123,34 @@ sys_waitpid(pid_t pid,
      Fix this!
   */
 
-  // do not support any options for now
-  if (options != 0) {
+#if OPT_A2
+  // WNOHANG is the only option we support
+  if (options & ~WNOHANG) {
     return(EINVAL);
   }
-#if OPT_A2
-  result = pid_wait(pid, &exitstatus);
+  // make sure the status can be stored before reaping anything;
+  // after that a failed copyout would lose the exit status for good
+  exitstatus = 0;
+  result = copyout((void *)&exitstatus,status,sizeof(int));
+  if (result) {
+    return(result);
+  }
+  result = pid_wait(pid, options, &reaped, &exitstatus);
   if (result) {
      return(result); 
   }
+  if (reaped == 0) {
+    // WNOHANG, and no child has exited yet
+    *retval = 0;
+    return(0);
+  }
   exitstatus = _MKWAIT_EXIT(exitstatus);
+  pid = reaped;
 #else
+  // do not support any options for now
+  if (options != 0) {
+    return(EINVAL);
+  }
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
 #endif /* OPT_A2 */
@@ -116,6 +163,49 @@ sys_waitpid(pid_t pid,
 }
 
 #if OPT_A2
+/*
+ * wait4: waitpid plus resource usage. We don't keep any, so the
+ * usage reported is all zero. That's known up front, so it's copied
+ * out before waiting: a bad rusage pointer fails without reaping the
+ * child.
+ */
+int
+sys_wait4(pid_t pid,
+	  userptr_t status,
+	  int options,
+	  userptr_t rusage,
+	  pid_t *retval)
+{
+  struct rusage ru;
+  int result;
+
+  if (rusage != NULL) {
+    bzero(&ru, sizeof(ru));
+    result = copyout(&ru, rusage, sizeof(ru));
+    if (result) {
+      return(result);
+    }
+  }
+  return(sys_waitpid(pid, status, options, retval));
+}
+#endif /* OPT_A2 */
+
+#if OPT_A2
+/*
+ * The thread id a forked child starts with: that of the thread that
+ * forked, so it finds its user stack where it left it.
+ */
+static
+unsigned
+fork_tid(void)
+{
+#if OPT_A3
+    return(curthread->t_tid);
+#else
+    return(0);
+#endif /* OPT_A3 */
+}
+
 int
 sys_fork(struct trapframe *tf,
         pid_t *retval)
@@ -126,7 +216,7 @@ sys_fork(struct trapframe *tf,
     struct trapframe *tf_cp;
 
     // create process structure for child process
-    proc_child = proc_create_runprogram(curproc->p_name);
+    proc_child = proc_create_runprogram(curproc->p_name, fork_tid());
     if (proc_child == NULL) {
         return(ENOMEM); 
     }
@@ -134,7 +224,7 @@ sys_fork(struct trapframe *tf,
     // create and copy address space
     errno = as_copy(curproc_getas(), &as_child);
     if (errno) {
-        pid_fail();
+        pid_fail(proc_child);
         proc_destroy(proc_child);
         return(errno);  
     }
@@ -143,7 +233,7 @@ sys_fork(struct trapframe *tf,
     tf_cp = kmalloc(sizeof(struct trapframe));
     if (tf_cp == NULL) {
         as_destroy(as_child); 
-        pid_fail();
+        pid_fail(proc_child);
         proc_destroy(proc_child);
         return(ENOMEM);
     }
@@ -160,7 +250,7 @@ sys_fork(struct trapframe *tf,
     if (errno) {
         kfree(tf_cp);
         as_destroy(as_child); 
-        pid_fail();
+        pid_fail(proc_child);
         proc_destroy(proc_child);
         return errno;
     }
@@ -171,19 +261,131 @@ sys_fork(struct trapframe *tf,
     return(0);
 }
 
-int sys_execv(const char *program, char **uargs) {
-    struct addrspace *as_new;
-    struct addrspace *as_old;
-	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-	int result;
+/*
+ * vfork: like fork, but the child runs in our address space instead
+ * of a copy, and we sleep until it gives it back by calling execv or
+ * _exit (see proc_vfork_release). Nothing is copied, so it's the
+ * cheap way to start another program.
+ */
+int
+sys_vfork(struct trapframe *tf,
+        pid_t *retval)
+{
+    int errno;
+    struct proc *proc_child;
+    struct trapframe *tf_cp;
+    struct semaphore *wait;
+    pid_t pid;
+
+    // create process structure for child process
+    proc_child = proc_create_runprogram(curproc->p_name, fork_tid());
+    if (proc_child == NULL) {
+        return(ENOMEM); 
+    }
+
+    wait = sem_create("vfork", 0);
+    if (wait == NULL) {
+        pid_fail(proc_child);
+        proc_destroy(proc_child);
+        return(ENOMEM);
+    }
+
+    // allocate trapframe in heap
+    tf_cp = kmalloc(sizeof(struct trapframe));
+    if (tf_cp == NULL) {
+        sem_destroy(wait);
+        pid_fail(proc_child);
+        proc_destroy(proc_child);
+        return(ENOMEM);
+    }
+
+    // copy trapframe into heap
+    *tf_cp = *tf;
+
+    // create thread for child process, lending it our address space
+    proc_child->p_vfork_wait = wait;
+    pid = proc_child->p_pid;
+    errno = thread_fork(curthread->t_name, 
+            proc_child, 
+            enter_forked_proces, 
+            tf_cp, 
+            (unsigned long) curproc_getas());
+    if (errno) {
+        kfree(tf_cp);
+        sem_destroy(wait);
+        pid_fail(proc_child);
+        proc_destroy(proc_child);
+        return errno;
+    }
+
+    // the child may be gone by the time this returns
+    P(wait);
+    sem_destroy(wait);
+
+    // set return value
+    *retval = pid;
+
+    return(0);
+}
+
+/*
+ * Program and arguments for execv and spawn, copied into the kernel.
+ *
+ * The argument strings are staged back to back in one EXEC_ARGS_MAX
+ * buffer, each copied straight into place, with no per-argument
+ * allocation. When the new stack is set up the argv array is built
+ * right after them in the same buffer, and the whole thing goes out in
+ * one copyout. The limit covers the strings and the argv array
+ * together, as ARG_MAX does on Unix; anything bigger is E2BIG.
+ *
+ * The limit is ARG_MAX, or less if that wouldn't leave a page of the
+ * new user stack free for the program to run on. It has to be checked
+ * here, while copying in: by the time the stack is set up, execv has
+ * already thrown away the old image.
+ */
+#define EXEC_ARGS_MAX \
+    (ARG_MAX < (USERSTACKPAGES - 1) * PAGE_SIZE ? \
+     ARG_MAX : (USERSTACKPAGES - 1) * PAGE_SIZE)
+
+struct exec_args {
+    char *ea_program;
+    char *ea_buf;       // EXEC_ARGS_MAX bytes: strings, then room for argv
+    size_t ea_len;      // bytes of strings in ea_buf
+    size_t ea_nargs;
+};
+
+static
+void
+exec_args_free(struct exec_args *ea)
+{
+    if (ea->ea_buf != NULL) {
+        kfree(ea->ea_buf);
+    }
+    kfree(ea->ea_program);
+}
+
+/*
+ * Size of the strings plus argv array, as laid out on the new stack.
+ */
+static
+size_t
+exec_args_size(size_t len, size_t nargs)
+{
+    return(ROUNDUP(len, sizeof(vaddr_t)) + sizeof(vaddr_t) * (nargs + 1));
+}
+
+static
+int
+exec_args_copyin(const char *program, char **uargs, struct exec_args *ea)
+{
     size_t size;
+    char *uarg;
+    int result;
 
-    char *program_kernel; 
-    size_t program_size;
-    char **uargs_kernel;
-    vaddr_t *uargs_user;
-    size_t uargs_size;
+    ea->ea_program = NULL;
+    ea->ea_buf = NULL;
+    ea->ea_len = 0;
+    ea->ea_nargs = 0;
 
     // ensure valid program and arguments
     if (program == NULL || uargs == NULL) {
@@ -191,119 +393,297 @@ int sys_execv(const char *program, char **uargs) {
     }
 
     // copy program from user space into kernel space
-    program_kernel = (char *) kmalloc(sizeof(char) * PATH_MAX); 
-    if (program_kernel == NULL) {
+    ea->ea_program = (char *) kmalloc(sizeof(char) * PATH_MAX); 
+    if (ea->ea_program == NULL) {
         return(ENOMEM); 
     }
-    result = copyinstr((const_userptr_t) program, program_kernel, PATH_MAX, &program_size);
-    if (result || program_size <= 1) {
-       kfree(program_kernel); 
-       return(EINVAL);
+    result = copyinstr((const_userptr_t) program, ea->ea_program, PATH_MAX, &size);
+    if (result) {
+        exec_args_free(ea);
+        return(result);
+    }
+    if (size <= 1) {
+        exec_args_free(ea);
+        return(EINVAL);
     }
 
-    // copy arguments from user space into kernel space
-    uargs_size = 0;
-    while (uargs[uargs_size] != NULL) {
-        uargs_size ++;
+    ea->ea_buf = (char *) kmalloc(EXEC_ARGS_MAX);
+    if (ea->ea_buf == NULL) {
+        exec_args_free(ea);
+        return(ENOMEM);
     }
 
-    uargs_kernel = (char **) kmalloc(sizeof(char *) * (uargs_size + 1));
-    for (size_t i = 0; i < uargs_size; ++i) {
-        uargs_kernel[i] = (char *) kmalloc(sizeof(char) * PATH_MAX);
-        result = copyinstr((const_userptr_t) uargs[i], uargs_kernel[i], PATH_MAX, &size);
+    // copy each argument string straight into the staging buffer
+    while (1) {
+        result = copyin((const_userptr_t) &uargs[ea->ea_nargs], &uarg, sizeof(char *));
+        if (result) {
+            exec_args_free(ea);
+            return(result);
+        }
+        if (uarg == NULL) {
+            break;
+        }
+        if (exec_args_size(ea->ea_len + 1, ea->ea_nargs + 1) > EXEC_ARGS_MAX) {
+            exec_args_free(ea);
+            return(E2BIG);
+        }
+        result = copyinstr((const_userptr_t) uarg, ea->ea_buf + ea->ea_len,
+                EXEC_ARGS_MAX - ea->ea_len, &size);
+        if (result == ENAMETOOLONG) {
+            result = E2BIG;
+        }
         if (result) {
-            kfree(program_kernel);
-            kfree(uargs_kernel);
-            return(EFAULT);
+            exec_args_free(ea);
+            return(result);
         }
+        ea->ea_len += size;
+        ea->ea_nargs ++;
+    }
+    if (exec_args_size(ea->ea_len, ea->ea_nargs) > EXEC_ARGS_MAX) {
+        exec_args_free(ea);
+        return(E2BIG);
+    }
+    return(0);
+}
+
+/*
+ * Load the program V into the current (new, empty) address space, set
+ * up its stack with EA's arguments, and return where to start it and
+ * its argv. Closes V.
+ */
+static
+int
+exec_image(struct exec_args *ea, struct vnode *v,
+        vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv)
+{
+    vaddr_t *uargs_user;
+    vaddr_t base;
+    size_t strsize, size, i, off;
+    int result;
+
+    // load the executable
+    result = load_elf(v, entrypoint);
+    // done with the file now
+    vfs_close(v);
+    if (result) {
+        return(result);
+    }
+
+    // define the user stack in the address space
+    result = as_define_stack(curproc_getas(), stackptr);
+    if (result) {
+        return(result);
+    }
+
+    // lay out the strings then argv at the top of the stack, and build
+    // argv behind the strings in the staging buffer to match
+    strsize = ROUNDUP(ea->ea_len, sizeof(vaddr_t));
+    size = exec_args_size(ea->ea_len, ea->ea_nargs);
+    KASSERT(size <= EXEC_ARGS_MAX);
+    base = *stackptr - ROUNDUP(size, 8);
+    uargs_user = (vaddr_t *) (ea->ea_buf + strsize);
+    off = 0;
+    for (i = 0; i < ea->ea_nargs; ++i) {
+        uargs_user[i] = base + off;
+        off += strlen(ea->ea_buf + off) + 1;
+    }
+    KASSERT(off == ea->ea_len);
+    uargs_user[ea->ea_nargs] = (vaddr_t) NULL;
+
+    // and out it all goes at once
+    result = copyout(ea->ea_buf, (userptr_t) base, size);
+    if (result) {
+        return(result);
+    }
+    *stackptr = base;
+    *argv = (userptr_t) (base + strsize);
+    return(0);
+}
+
+int sys_execv(const char *program, char **uargs) {
+    struct exec_args ea;
+    struct addrspace *as_new;
+    struct addrspace *as_old;
+    struct vnode *v;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv;
+    int result;
+
+    result = exec_args_copyin(program, uargs, &ea);
+    if (result) {
+        return(result);
+    }
+
+    // open the file
+    result = vfs_open(ea.ea_program, O_RDONLY, 0, &v);
+    if (result) {
+        exec_args_free(&ea);
+        return result;
     }
-    uargs_kernel[uargs_size] = NULL;
-    
-	// open the file
-	result = vfs_open(program_kernel, O_RDONLY, 0, &v);
-	if (result) {
-        kfree(program_kernel);
-        kfree(uargs_kernel);
-		return result;
-	}
 
     // create new address space
     as_new = as_create();
     if (as_new == NULL) {
-        kfree(program_kernel);
-        kfree(uargs_kernel);
+        exec_args_free(&ea);
         vfs_close(v);
         return(ENOMEM);
     }
     
-    // set new address space, delete old address space, and activate new address space
+#if OPT_A3
+    // the new image starts with only this thread; if another thread
+    // is already exiting the process, give everything back and let
+    // the way out to user mode take us away
+    result = proc_uthread_killothers();
+    if (result) {
+        as_destroy(as_new);
+        vfs_close(v);
+        exec_args_free(&ea);
+        return(result);
+    }
+#endif /* OPT_A3 */
+
+    // set new address space, delete old address space (or give it back
+    // to our vfork parent), and activate new address space
     as_old = curproc_setas(as_new);
-    as_destroy(as_old);
+    if (!proc_vfork_release()) {
+        as_destroy(as_old);
+    }
     as_activate();
 
-    // load the executable
-	result = load_elf(v, &entrypoint);
-	if (result) {
-		// p_addrspace will go away when curproc is destroyed
-        kfree(program_kernel);
-        kfree(uargs_kernel);
-		vfs_close(v);
-		return result;
-	}
+    // load the executable and set up its arguments
+    // (on failure p_addrspace will go away when curproc is destroyed)
+    result = exec_image(&ea, v, &entrypoint, &stackptr, &argv);
+    if (result) {
+        exec_args_free(&ea);
+        return result;
+    }
 
-    // done with the file now
-    vfs_close(v);
+    // free kernel space program and arguments
+    int argc = ea.ea_nargs;
+    exec_args_free(&ea);
 
-    // define the user stack in the address space
-	result = as_define_stack(as_new, &stackptr);
-	if (result) {
-		// p_addrspace will go away when curproc is destroyed
-        kfree(program_kernel);
-        kfree(uargs_kernel);
-		return result;
-	}
-
-    // copy argument strings into user space, and keep track of virtual address
-    uargs_user = (vaddr_t *) kmalloc(sizeof(vaddr_t) * (uargs_size + 1));
-    for (size_t i = 0; i < uargs_size; ++i) {
-        size = ROUNDUP(strlen(uargs_kernel[i]) + 1, 8);
-        stackptr -= size;
-        result = copyoutstr((const char *) uargs_kernel[i], (userptr_t) stackptr, size, &size);
-        if (result) {
-            kfree(program_kernel);
-            kfree(uargs_kernel);
-            kfree(uargs_user);
-            return result;
+    // warp to user mode
+    enter_new_process(argc, argv, stackptr, entrypoint);
+	
+    // enter_new_process does not return
+    panic("enter_new_process returned\n");
+    return(EINVAL);
+}
+
+/*
+ * spawn: start PROGRAM with arguments UARGS in a new child process,
+ * without copying ourselves first. The child loads the program and
+ * reports back before we return, so errors like a missing program
+ * come back from spawn itself.
+ */
+struct spawn_data {
+    struct exec_args *sd_args;
+    struct semaphore *sd_done;
+    int sd_result;
+};
+
+static
+void
+enter_spawned_process(void *data, unsigned long unused)
+{
+    struct spawn_data *sd = data;
+    struct exec_args *ea = sd->sd_args;
+    struct addrspace *as;
+    struct vnode *v;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv;
+    int argc = ea->ea_nargs;
+    int result;
+
+    (void)unused;
+
+#if OPT_A3
+    // a new program starts out as thread 0, whoever spawned it
+    curthread->t_tid = 0;
+#endif /* OPT_A3 */
+
+    as = as_create();
+    if (as == NULL) {
+        result = ENOMEM;
+    } else {
+        curproc_setas(as);
+        as_activate();
+        result = vfs_open(ea->ea_program, O_RDONLY, 0, &v);
+        if (result == 0) {
+            result = exec_image(ea, v, &entrypoint, &stackptr, &argv);
         }
+    }
+
+    // sd lives on the parent's stack; done with it after this
+    sd->sd_result = result;
+    V(sd->sd_done);
 
-        uargs_user[i] = stackptr;     
+    if (result) {
+        // the parent reaps us
+        sys__exit(255);
     }
-    uargs_user[uargs_size] = (vaddr_t) NULL;
-    
-    // copy argument array of virtual address into user space
-    size = sizeof(vaddr_t) * (uargs_size + 1);
-    stackptr -= ROUNDUP(size, 8);
-    result = copyout((const void *) uargs_user, (userptr_t) stackptr, size);
+
+    // warp to user mode
+    enter_new_process(argc, argv, stackptr, entrypoint);
+    panic("enter_new_process returned\n");
+}
+
+int
+sys_spawn(const char *program, char **uargs, pid_t *retval)
+{
+    struct exec_args ea;
+    struct spawn_data sd;
+    struct proc *proc_child;
+    pid_t pid, reaped;
+    int exitstatus;
+    int result;
+
+    result = exec_args_copyin(program, uargs, &ea);
     if (result) {
-        kfree(program_kernel);
-        kfree(uargs_kernel);
-        kfree(uargs_user);
+        return(result);
     }
 
-    // free kernel space program and arguments
-    kfree(program_kernel);
-    kfree(uargs_kernel);
-
-	// warp to user mode
-	enter_new_process(uargs_size /*argc*/, 
-            (userptr_t) stackptr /*userspace addr of argv*/,
-            stackptr, 
-            entrypoint);
-	
-	// enter_new_process does not return
-	panic("enter_new_process returned\n");
-	return(EINVAL);
+    proc_child = proc_create_runprogram(ea.ea_nargs > 0 ?
+            ea.ea_buf : ea.ea_program, 0);
+    if (proc_child == NULL) {
+        exec_args_free(&ea);
+        return(ENOMEM); 
+    }
+    pid = proc_child->p_pid;
+
+    sd.sd_args = &ea;
+    sd.sd_result = 0;
+    sd.sd_done = sem_create("spawn", 0);
+    if (sd.sd_done == NULL) {
+        pid_fail(proc_child);
+        proc_destroy(proc_child);
+        exec_args_free(&ea);
+        return(ENOMEM);
+    }
+
+    result = thread_fork(curthread->t_name, proc_child,
+            enter_spawned_process, &sd, 0);
+    if (result) {
+        sem_destroy(sd.sd_done);
+        pid_fail(proc_child);
+        proc_destroy(proc_child);
+        exec_args_free(&ea);
+        return(result);
+    }
+
+    // wait for the child to load the program or fail to
+    P(sd.sd_done);
+    sem_destroy(sd.sd_done);
+    exec_args_free(&ea);
+
+    if (sd.sd_result) {
+        // it exits straight away; don't leave it for the caller
+        pid_wait(pid, 0, &reaped, &exitstatus);
+        return(sd.sd_result);
+    }
+
+    *retval = pid;
+    return(0);
 }
 
 #endif /* OPT_A2 */
-
@@ -0,0 +1,115 @@
+#include "opt-A3.h"
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <mips/trapframe.h>
+
+/*
+ * System calls for user-level threads. The thread bookkeeping lives
+ * in proc.c; the extra user stacks come from as_define_threadstack.
+ */
+
+#if OPT_A3
+/*
+ * First function run by a new user thread. TF is the kmalloc'd
+ * trapframe set up by sys___threadfork.
+ */
+static
+void
+enter_threadfork(void *tf, unsigned long tid)
+{
+    // copy trapframe onto kernel stack
+    struct trapframe tf_thread = *(struct trapframe *) tf;
+    kfree(tf);
+
+    curthread->t_tid = tid;
+
+    // the process may have started exiting while we were created
+    proc_uthread_checkexit();
+
+    // enter usermode
+    mips_usermode(&tf_thread);
+}
+
+int
+sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg,
+        int *retval)
+{
+    struct proc *p = curproc;
+    struct trapframe *tf_thread;
+    vaddr_t stackptr;
+    unsigned tid;
+    int result;
+
+    // pick a thread id, which also picks the stack slot
+    result = proc_uthread_alloc(p, &tid);
+    if (result) {
+        return(result);
+    }
+
+    result = as_define_threadstack(curproc_getas(), tid, &stackptr);
+    if (result) {
+        proc_uthread_free(p, tid);
+        return(result);
+    }
+
+    // start from the caller's registers so $gp and the status are right
+    tf_thread = kmalloc(sizeof(struct trapframe));
+    if (tf_thread == NULL) {
+        proc_uthread_free(p, tid);
+        return(ENOMEM);
+    }
+    *tf_thread = *tf;
+    tf_thread->tf_epc = (vaddr_t) entry;
+    tf_thread->tf_a0 = (uint32_t) arg;
+    tf_thread->tf_ra = 0;
+    // leave room for the callee to spill its argument registers
+    tf_thread->tf_sp = stackptr - 16;
+
+    result = thread_fork(curthread->t_name, p, enter_threadfork,
+            tf_thread, tid);
+    if (result) {
+        kfree(tf_thread);
+        proc_uthread_free(p, tid);
+        return(result);
+    }
+
+    *retval = tid;
+    return(0);
+}
+
+int
+sys_threadjoin(int tid, userptr_t status)
+{
+    int exitval;
+    int result;
+
+    if (tid < 0) {
+        return(ESRCH);
+    }
+    result = proc_uthread_join(tid, &exitval);
+    if (result) {
+        return(result);
+    }
+    if (status != NULL) {
+        result = copyout(&exitval, status, sizeof(int));
+    }
+    return(result);
+}
+
+void
+sys_threadexit(int exitval)
+{
+    if (!proc_uthread_exit(exitval)) {
+        // last thread standing takes the process with it
+        sys__exit(exitval);
+    }
+    panic("return from proc_uthread_exit in sys_threadexit\n");
+}
+#endif /* OPT_A3 */
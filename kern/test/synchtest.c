@@ -32,11 +32,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
+#include <lockdep.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
@@ -347,3 +349,434 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Lock contention benchmark: several threads hammer one lock with a
+ * short critical section, once with plain blocking locks and once
+ * with adaptive (spin-then-block) locks.
+ */
+
+#define LOCKBENCH_THREADS   4	/* default number of threads */
+#define LOCKBENCH_LOOPS     2000	/* lock_acquire calls per thread */
+#define LOCKBENCH_HOLD      20	/* loop iterations inside the lock */
+
+static struct lock *benchlock;
+static struct semaphore *benchdone;
+static volatile unsigned long benchcount;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<LOCKBENCH_LOOPS; i++) {
+		lock_acquire(benchlock);
+		benchcount++;
+		for (j=0; j<LOCKBENCH_HOLD; j++);
+		lock_release(benchlock);
+		for (j=0; j<LOCKBENCH_HOLD; j++);
+	}
+	V(benchdone);
+}
+
+static
+void
+lockbench_run(unsigned long nthreads, bool adaptive)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	uint64_t total;
+	unsigned long i;
+	int result;
+
+	lock_setadaptive(benchlock, adaptive);
+	benchcount = 0;
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	if (benchcount != nthreads * LOCKBENCH_LOOPS) {
+		panic("lockbench: count is %lu, should be %lu\n",
+		      benchcount, nthreads * LOCKBENCH_LOOPS);
+	}
+
+	total = (uint64_t)secs * 1000000000 + nsecs;
+	kprintf("%-8s: %lu acquires in %lu.%09lu seconds: %lu ns each\n",
+		adaptive ? "adaptive" : "blocking", benchcount,
+		(unsigned long) secs, (unsigned long) nsecs,
+		(unsigned long)(total / benchcount));
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned long nthreads;
+
+	nthreads = LOCKBENCH_THREADS;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2 || nthreads == 0 || nthreads > NTHREADS) {
+		kprintf("Usage: sy4 [threads (1-%d)]\n", NTHREADS);
+		return EINVAL;
+	}
+
+	benchlock = lock_create("benchlock");
+	benchdone = sem_create("benchdone", 0);
+	if (benchlock == NULL || benchdone == NULL) {
+		panic("lockbench: out of memory\n");
+	}
+
+	kprintf("Starting lock benchmark: %lu threads, %d acquires each...\n",
+		nthreads, LOCKBENCH_LOOPS);
+	lockbench_run(nthreads, false);
+	lockbench_run(nthreads, true);
+
+	lock_destroy(benchlock);
+	sem_destroy(benchdone);
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Spinlock benchmark. Threads fight over one spinlock until between
+ * them they have taken it SPINBENCH_TOTAL times, once with an
+ * ordinary test-and-set spinlock and once with a ticket lock. Each
+ * thread counts its own acquisitions; with a fair lock the counts
+ * should come out close together, so we print the spread as well as
+ * the throughput.
+ */
+
+#define SPINBENCH_TOTAL     20000	/* acquisitions over all threads */
+#define SPINBENCH_HOLD      20	/* loop iterations inside the lock */
+
+static struct spinlock benchspin;
+static volatile unsigned long spinbench_counts[NTHREADS];
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	bool done;
+	volatile int j;
+
+	(void)junk;
+
+	done = false;
+	while (!done) {
+		spinlock_acquire(&benchspin);
+		if (benchcount < SPINBENCH_TOTAL) {
+			benchcount++;
+			spinbench_counts[num]++;
+			for (j=0; j<SPINBENCH_HOLD; j++);
+		}
+		else {
+			done = true;
+		}
+		spinlock_release(&benchspin);
+		for (j=0; j<SPINBENCH_HOLD; j++);
+	}
+	V(benchdone);
+}
+
+static
+void
+spinbench_run(unsigned long nthreads, bool ticket)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	uint64_t total;
+	unsigned long i, min, max;
+	int result;
+
+	if (ticket) {
+		spinlock_init_ticket(&benchspin);
+	}
+	else {
+		spinlock_init(&benchspin);
+	}
+	benchcount = 0;
+	for (i=0; i<nthreads; i++) {
+		spinbench_counts[i] = 0;
+	}
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	spinlock_cleanup(&benchspin);
+
+	min = max = spinbench_counts[0];
+	for (i=1; i<nthreads; i++) {
+		if (spinbench_counts[i] < min) {
+			min = spinbench_counts[i];
+		}
+		if (spinbench_counts[i] > max) {
+			max = spinbench_counts[i];
+		}
+	}
+
+	total = (uint64_t)secs * 1000000000 + nsecs;
+	kprintf("%-8s: %lu acquires in %lu.%09lu seconds: %lu ns each\n",
+		ticket ? "ticket" : "tas", benchcount,
+		(unsigned long) secs, (unsigned long) nsecs,
+		(unsigned long)(total / benchcount));
+	kprintf("%-8s  per thread: min %lu, max %lu\n", "", min, max);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned long nthreads;
+
+	nthreads = LOCKBENCH_THREADS;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2 || nthreads == 0 || nthreads > NTHREADS) {
+		kprintf("Usage: sy6 [threads (1-%d)]\n", NTHREADS);
+		return EINVAL;
+	}
+
+	benchdone = sem_create("benchdone", 0);
+	if (benchdone == NULL) {
+		panic("spinbench: out of memory\n");
+	}
+
+	kprintf("Starting spinlock benchmark: %lu threads, "
+		"%d acquires in all...\n", nthreads, SPINBENCH_TOTAL);
+	spinbench_run(nthreads, false);
+	spinbench_run(nthreads, true);
+
+	sem_destroy(benchdone);
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Reader-writer lock stress test. NTHREADS threads each take the lock
+ * RWLOOPS times, as a writer one time in RWWRITERS. Writers fill a
+ * shared array with their own number, yielding part way through;
+ * readers check that they always see a single writer's complete
+ * pattern and that no writer is in at the same time. Because writers
+ * have preference the test also finishes with readers piling up.
+ */
+
+#define RWLOOPS      200
+#define RWWRITERS    4	/* one in RWWRITERS acquires is a write */
+#define RWDATASIZE   16
+
+static struct rwlock *testrw;
+static struct spinlock rwcountlock = SPINLOCK_INITIALIZER;
+static volatile unsigned long rwdata[RWDATASIZE];
+static volatile unsigned rwreaders, rwwriters, rwmaxreaders;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	panic("rwtest: thread %lu: %s\n", num, msg);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i, j;
+
+	(void)junk;
+
+	for (i=0; i<RWLOOPS; i++) {
+		if (random() % RWWRITERS == 0) {
+			rwlock_acquire_write(testrw);
+			spinlock_acquire(&rwcountlock);
+			rwwriters++;
+			if (rwwriters != 1 || rwreaders != 0) {
+				rwfail(num, "writer not alone");
+			}
+			spinlock_release(&rwcountlock);
+
+			for (j=0; j<RWDATASIZE; j++) {
+				rwdata[j] = num;
+				if (j == RWDATASIZE/2) {
+					thread_yield();
+				}
+			}
+
+			spinlock_acquire(&rwcountlock);
+			rwwriters--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spinlock_acquire(&rwcountlock);
+			rwreaders++;
+			if (rwwriters != 0) {
+				rwfail(num, "reader with writer");
+			}
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			spinlock_release(&rwcountlock);
+
+			for (j=0; j<RWDATASIZE; j++) {
+				if (rwdata[j] != rwdata[0]) {
+					rwfail(num, "torn write");
+				}
+				if (j == RWDATASIZE/2) {
+					thread_yield();
+				}
+			}
+
+			spinlock_acquire(&rwcountlock);
+			rwreaders--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(benchdone);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	testrw = rwlock_create("testrw");
+	benchdone = sem_create("rwdone", 0);
+	if (testrw == NULL || benchdone == NULL) {
+		panic("rwtest: out of memory\n");
+	}
+	rwreaders = rwwriters = rwmaxreaders = 0;
+	for (i=0; i<RWDATASIZE; i++) {
+		rwdata[i] = 0;
+	}
+
+	kprintf("Starting rwlock test...\n");
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(benchdone);
+	}
+
+	rwlock_destroy(testrw);
+	sem_destroy(benchdone);
+	kprintf("Up to %u readers held the lock at once.\n", rwmaxreaders);
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+#if OPT_LOCKDEP
+/*
+ * Lock order validator test. Take two locks in one order and then the
+ * other, in the same thread so nothing can actually deadlock, and
+ * check that lockdep noticed. Then do the same with a lock and an
+ * rwlock, and finally check that a consistent order stays quiet.
+ */
+int
+lockdeptest(int nargs, char **args)
+{
+	struct lock *a, *b, *c;
+	struct rwlock *rw;
+	unsigned before;
+
+	(void)nargs;
+	(void)args;
+
+	a = lock_create("lockdeptest a");
+	b = lock_create("lockdeptest b");
+	c = lock_create("lockdeptest c");
+	rw = rwlock_create("lockdeptest rw");
+	if (a == NULL || b == NULL || c == NULL || rw == NULL) {
+		panic("lockdeptest: out of memory\n");
+	}
+
+	kprintf("Starting lockdep test; expect two reports...\n");
+
+	before = lockdep_reports();
+	lock_acquire(a);
+	lock_acquire(b);
+	lock_release(b);
+	lock_release(a);
+	lock_acquire(b);
+	lock_acquire(a);
+	lock_release(a);
+	lock_release(b);
+	if (lockdep_reports() != before + 1) {
+		panic("lockdeptest: a/b inversion not reported\n");
+	}
+
+	rwlock_acquire_read(rw);
+	lock_acquire(c);
+	lock_release(c);
+	rwlock_release_read(rw);
+	lock_acquire(c);
+	rwlock_acquire_write(rw);
+	rwlock_release_write(rw);
+	lock_release(c);
+	if (lockdep_reports() != before + 2) {
+		panic("lockdeptest: rw/c inversion not reported\n");
+	}
+
+	lock_acquire(a);
+	lock_acquire(c);
+	lock_release(c);
+	lock_release(a);
+	lock_acquire(a);
+	lock_acquire(c);
+	lock_release(c);
+	lock_release(a);
+	if (lockdep_reports() != before + 2) {
+		panic("lockdeptest: consistent order reported\n");
+	}
+
+	rwlock_destroy(rw);
+	lock_destroy(c);
+	lock_destroy(b);
+	lock_destroy(a);
+	kprintf("Lockdep test done.\n");
+
+	return 0;
+}
+#endif /* OPT_LOCKDEP */
@@ -0,0 +1,217 @@
+/*
+ * Thread system benchmarks.
+ *
+ * tb1 (forkbench) measures how fast thread_fork can create threads
+ * that exit immediately, which is dominated by the cost of setting
+ * up and tearing down struct thread and its kernel stack.
+ *
+ * tb2 (wakeupbench) runs pairs of threads that wake each other up
+ * through semaphores, as fast as they can. With more than one cpu
+ * the pairs get spread out by migration, so most wakeups are remote
+ * ones; it reports round trips per second and how much contention
+ * there was on the cpus' remote wakeup lists.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define FORKBENCH_DEFAULT  2000	/* threads forked per run */
+#define FORKBENCH_BATCH    16	/* threads alive at once */
+
+#define WAKEUPBENCH_PAIRS   4	/* default number of ping-pong pairs */
+#define WAKEUPBENCH_MAXPAIRS 16
+#define WAKEUPBENCH_ROUNDS  2000	/* round trips per pair */
+
+static struct semaphore *benchsem = NULL;
+
+static
+void
+init_benchsem(void)
+{
+	if (benchsem == NULL) {
+		benchsem = sem_create("benchsem", 0);
+		if (benchsem == NULL) {
+			panic("threadbench: sem_create failed\n");
+		}
+	}
+}
+
+/*
+ * Compute the rate, in operations per second, of COUNT operations
+ * done in SECS.NSECS seconds.
+ */
+static
+unsigned long
+bench_rate(unsigned long count, time_t secs, uint32_t nsecs)
+{
+	uint64_t total;
+
+	total = (uint64_t)secs * 1000000000 + nsecs;
+	if (total == 0) {
+		return 0;
+	}
+	return (unsigned long)(((uint64_t)count * 1000000000) / total);
+}
+
+static
+void
+forkbenchthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(benchsem);
+}
+
+int
+forkbench(int nargs, char **args)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long count, i, j;
+	int result;
+
+	count = FORKBENCH_DEFAULT;
+	if (nargs > 1) {
+		count = atoi(args[1]);
+	}
+	if (nargs > 2 || count == 0) {
+		kprintf("Usage: tb1 [count]\n");
+		return EINVAL;
+	}
+	count = ROUNDUP(count, FORKBENCH_BATCH);
+
+	init_benchsem();
+	kprintf("Starting fork benchmark: %lu threads...\n", count);
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<count; i+=FORKBENCH_BATCH) {
+		for (j=0; j<FORKBENCH_BATCH; j++) {
+			result = thread_fork("forkbench", NULL,
+					     forkbenchthread, NULL, i+j);
+			if (result) {
+				panic("forkbench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<FORKBENCH_BATCH; j++) {
+			P(benchsem);
+		}
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	kprintf("%lu forks in %lu.%09lu seconds: %lu forks/sec\n",
+		count, (unsigned long) secs, (unsigned long) nsecs,
+		bench_rate(count, secs, nsecs));
+	kprintf("Fork benchmark done.\n");
+
+	return 0;
+}
+
+static struct semaphore *pingsems[WAKEUPBENCH_MAXPAIRS];
+static struct semaphore *pongsems[WAKEUPBENCH_MAXPAIRS];
+
+static
+void
+pingthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<WAKEUPBENCH_ROUNDS; i++) {
+		V(pongsems[num]);
+		P(pingsems[num]);
+	}
+	V(benchsem);
+}
+
+static
+void
+pongthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<WAKEUPBENCH_ROUNDS; i++) {
+		P(pongsems[num]);
+		V(pingsems[num]);
+	}
+	V(benchsem);
+}
+
+int
+wakeupbench(int nargs, char **args)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned sent1, retries1, sent2, retries2;
+	unsigned long npairs, i;
+	int result;
+
+	npairs = WAKEUPBENCH_PAIRS;
+	if (nargs > 1) {
+		npairs = atoi(args[1]);
+	}
+	if (nargs > 2 || npairs == 0 || npairs > WAKEUPBENCH_MAXPAIRS) {
+		kprintf("Usage: tb2 [pairs (1-%d)]\n", WAKEUPBENCH_MAXPAIRS);
+		return EINVAL;
+	}
+
+	init_benchsem();
+	for (i=0; i<npairs; i++) {
+		pingsems[i] = sem_create("ping", 0);
+		pongsems[i] = sem_create("pong", 0);
+		if (pingsems[i] == NULL || pongsems[i] == NULL) {
+			panic("wakeupbench: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting wakeup benchmark: %lu pairs, %d round trips "
+		"each...\n", npairs, WAKEUPBENCH_ROUNDS);
+
+	thread_wakeupstats(&sent1, &retries1);
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<npairs; i++) {
+		result = thread_fork("ping", NULL, pingthread, NULL, i);
+		if (result) {
+			panic("wakeupbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		result = thread_fork("pong", NULL, pongthread, NULL, i);
+		if (result) {
+			panic("wakeupbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<2*npairs; i++) {
+		P(benchsem);
+	}
+	gettime(&aftersecs, &afternsecs);
+	thread_wakeupstats(&sent2, &retries2);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	for (i=0; i<npairs; i++) {
+		sem_destroy(pingsems[i]);
+		sem_destroy(pongsems[i]);
+	}
+
+	kprintf("%lu round trips in %lu.%09lu seconds: %lu round trips/sec\n",
+		npairs * WAKEUPBENCH_ROUNDS,
+		(unsigned long) secs, (unsigned long) nsecs,
+		bench_rate(npairs * WAKEUPBENCH_ROUNDS, secs, nsecs));
+	kprintf("Remote wakeups: %u, compare-and-swap retries: %u\n",
+		sent2 - sent1, retries2 - retries1);
+	kprintf("Wakeup benchmark done.\n");
+
+	return 0;
+}
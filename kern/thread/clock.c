@@ -32,8 +32,10 @@
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <poll.h>
 #include <thread.h>
 #include <current.h>
+#include <schedtrace.h>
 
 /*
  * Time handling.
@@ -93,6 +95,12 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+
+	/* Unlocked, but it's only a sample. */
+	schedtrace_sample(curcpu->c_runqueue.tl_count);
+
+	poll_hardclock();
+
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
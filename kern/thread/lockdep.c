@@ -0,0 +1,338 @@
+/*
+ * Lock order validator. See lockdep.h.
+ *
+ * The class table and the dependency graph are protected by
+ * lockdep_lock, a spinlock; spinlocks aren't tracked, so there's no
+ * recursion. Edges are only ever added, so the fast path that checks
+ * whether an edge is already there reads the graph without the lock.
+ * The held-class stack is per thread and needs no locking at all.
+ *
+ * Reports are printed after dropping lockdep_lock, since kprintf
+ * takes a sleep lock (which comes back through here; that's fine).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <lockdep.h>
+
+/* Number of lock classes we can keep track of. Multiple of 32. */
+#define LOCKDEP_NCLASSES	128
+
+/* Length of the name kept for each class, including the null. */
+#define LOCKDEP_NAMELEN		24
+
+/* Longest dependency chain printed in a report. */
+#define LOCKDEP_MAXPATH		16
+
+#define LOCKDEP_NOCLASS		(-1)
+
+struct lockdep_class {
+	char lc_name[LOCKDEP_NAMELEN];	/* lock name, maybe cut short */
+	const void *lc_site;		/* first caller of lock_create */
+};
+
+static struct spinlock lockdep_lock = SPINLOCK_INITIALIZER;
+static struct lockdep_class lockdep_classes[LOCKDEP_NCLASSES];
+static unsigned lockdep_nclasses;
+static bool lockdep_fullwarned;
+static unsigned lockdep_nreports;
+
+/*
+ * The graph: bit B of lockdep_after[A] is set if some thread has
+ * gone for a lock of class B while holding one of class A.
+ */
+static volatile uint32_t
+	lockdep_after[LOCKDEP_NCLASSES][LOCKDEP_NCLASSES / 32];
+
+/* Scratch space for lockdep_findpath; protected by lockdep_lock. */
+static int lockdep_parent[LOCKDEP_NCLASSES];
+static int lockdep_queue[LOCKDEP_NCLASSES];
+
+static
+bool
+lockdep_hasedge(int a, int b)
+{
+	return (lockdep_after[a][b / 32] & ((uint32_t)1 << (b % 32))) != 0;
+}
+
+static
+void
+lockdep_setedge(int a, int b)
+{
+	lockdep_after[a][b / 32] |= (uint32_t)1 << (b % 32);
+}
+
+/*
+ * Does NAME, cut to the length we keep, equal class LC's name?
+ */
+static
+bool
+lockdep_samename(struct lockdep_class *lc, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKDEP_NAMELEN - 1; i++) {
+		if (lc->lc_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == '\0') {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find the class for locks called NAME, making one if needed.
+ */
+static
+int
+lockdep_getclass(const char *name, const void *site)
+{
+	struct lockdep_class *lc;
+	unsigned i, j;
+	bool warn;
+
+	warn = false;
+	spinlock_acquire(&lockdep_lock);
+	for (i = 0; i < lockdep_nclasses; i++) {
+		if (lockdep_samename(&lockdep_classes[i], name)) {
+			spinlock_release(&lockdep_lock);
+			return i;
+		}
+	}
+	if (lockdep_nclasses == LOCKDEP_NCLASSES) {
+		warn = !lockdep_fullwarned;
+		lockdep_fullwarned = true;
+		spinlock_release(&lockdep_lock);
+		if (warn) {
+			kprintf("lockdep: too many lock classes; "
+				"not checking %s and later ones\n", name);
+		}
+		return LOCKDEP_NOCLASS;
+	}
+	lc = &lockdep_classes[lockdep_nclasses];
+	for (j = 0; j < LOCKDEP_NAMELEN - 1 && name[j] != '\0'; j++) {
+		lc->lc_name[j] = name[j];
+	}
+	lc->lc_name[j] = '\0';
+	lc->lc_site = site;
+	lockdep_nclasses++;
+	spinlock_release(&lockdep_lock);
+	return i;
+}
+
+/*
+ * Look for a path FROM -> ... -> TO in the graph, breadth first so
+ * it's a shortest one. If there is one, put the last LOCKDEP_MAXPATH
+ * classes on it in PATH, starting from TO and going backwards, and
+ * return its full length in classes. Otherwise return 0.
+ */
+static
+unsigned
+lockdep_findpath(int from, int to, int *path)
+{
+	unsigned head, tail, len;
+	int a, b;
+
+	KASSERT(spinlock_do_i_hold(&lockdep_lock));
+
+	for (a = 0; a < (int)lockdep_nclasses; a++) {
+		lockdep_parent[a] = LOCKDEP_NOCLASS;
+	}
+
+	head = tail = 0;
+	lockdep_queue[tail++] = from;
+	lockdep_parent[from] = from;
+	while (head < tail && lockdep_parent[to] == LOCKDEP_NOCLASS) {
+		a = lockdep_queue[head++];
+		for (b = 0; b < (int)lockdep_nclasses; b++) {
+			if (lockdep_parent[b] == LOCKDEP_NOCLASS &&
+			    lockdep_hasedge(a, b)) {
+				lockdep_parent[b] = a;
+				lockdep_queue[tail++] = b;
+			}
+		}
+	}
+	if (lockdep_parent[to] == LOCKDEP_NOCLASS) {
+		return 0;
+	}
+
+	len = 0;
+	for (a = to; ; a = lockdep_parent[a]) {
+		if (len < LOCKDEP_MAXPATH) {
+			path[len] = a;
+		}
+		len++;
+		if (a == from) {
+			break;
+		}
+	}
+	return len;
+}
+
+static
+void
+lockdep_printclass(const char *what, int cls)
+{
+	kprintf("lockdep:   %s %s (created at %p)\n", what,
+		lockdep_classes[cls].lc_name, lockdep_classes[cls].lc_site);
+}
+
+/*
+ * Report that we're going for class WANT while holding class HELD,
+ * but WANT has already been seen coming (via PATH) before HELD.
+ */
+static
+void
+lockdep_report(int held, int want, const int *path, unsigned len)
+{
+	unsigned i, shown;
+
+	kprintf("lockdep: possible deadlock in thread %s\n",
+		curthread->t_name);
+	lockdep_printclass("acquiring", want);
+	lockdep_printclass("while holding", held);
+	if (held == want) {
+		kprintf("lockdep:   two locks of the same class nest with "
+			"no order between them\n");
+		return;
+	}
+	kprintf("lockdep:   but these have been taken in this order:\n");
+	shown = len < LOCKDEP_MAXPATH ? len : LOCKDEP_MAXPATH;
+	if (shown < len) {
+		kprintf("lockdep:     %s, and %u more, then\n",
+			lockdep_classes[want].lc_name, len - shown);
+	}
+	for (i = shown; i-- > 0; ) {
+		kprintf("lockdep:     %s (created at %p)\n",
+			lockdep_classes[path[i]].lc_name,
+			lockdep_classes[path[i]].lc_site);
+	}
+}
+
+/*
+ * Check and record that the current thread is going for a lock of
+ * class CLS. Called before it might block on it.
+ */
+static
+void
+lockdep_acquire(int cls)
+{
+	struct thread *t = curthread;
+	int path[LOCKDEP_MAXPATH];
+	unsigned i, len;
+	int held;
+
+	if (cls == LOCKDEP_NOCLASS) {
+		return;
+	}
+
+	for (i = 0; i < t->t_lockdep_nheld; i++) {
+		held = t->t_lockdep_held[i];
+		if (lockdep_hasedge(held, cls)) {
+			continue;
+		}
+
+		/* A new edge held -> cls; does cls already lead to held? */
+		len = 0;
+		spinlock_acquire(&lockdep_lock);
+		if (!lockdep_hasedge(held, cls)) {
+			len = lockdep_findpath(cls, held, path);
+			lockdep_setedge(held, cls);
+			if (len > 0) {
+				lockdep_nreports++;
+			}
+		}
+		spinlock_release(&lockdep_lock);
+
+		if (len > 0) {
+			lockdep_report(held, cls, path, len);
+		}
+	}
+
+	if (t->t_lockdep_nheld == LOCKDEP_MAXHELD) {
+		kprintf("lockdep: thread %s holds too many locks; "
+			"not checking %s\n", t->t_name,
+			lockdep_classes[cls].lc_name);
+		return;
+	}
+	t->t_lockdep_held[t->t_lockdep_nheld++] = cls;
+}
+
+/*
+ * The current thread has let go of a lock of class CLS.
+ */
+static
+void
+lockdep_release(int cls)
+{
+	struct thread *t = curthread;
+	unsigned i;
+
+	if (cls == LOCKDEP_NOCLASS) {
+		return;
+	}
+
+	/* Usually it's the last one, but locks needn't nest. */
+	for (i = t->t_lockdep_nheld; i-- > 0; ) {
+		if (t->t_lockdep_held[i] == cls) {
+			t->t_lockdep_nheld--;
+			for (; i < t->t_lockdep_nheld; i++) {
+				t->t_lockdep_held[i] =
+					t->t_lockdep_held[i + 1];
+			}
+			return;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Hooks.
+
+void
+lockdep_lock_init(struct lock *lk, const void *site)
+{
+	lk->lk_depclass = lockdep_getclass(lk->lk_name, site);
+}
+
+void
+lockdep_lock_acquire(struct lock *lk)
+{
+	lockdep_acquire(lk->lk_depclass);
+}
+
+void
+lockdep_lock_release(struct lock *lk)
+{
+	lockdep_release(lk->lk_depclass);
+}
+
+void
+lockdep_rwlock_init(struct rwlock *rw, const void *site)
+{
+	rw->rw_depclass = lockdep_getclass(rw->rw_name, site);
+}
+
+void
+lockdep_rwlock_acquire(struct rwlock *rw)
+{
+	lockdep_acquire(rw->rw_depclass);
+}
+
+void
+lockdep_rwlock_release(struct rwlock *rw)
+{
+	lockdep_release(rw->rw_depclass);
+}
+
+unsigned
+lockdep_reports(void)
+{
+	return lockdep_nreports;
+}
@@ -0,0 +1,414 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ *
+ * The hooks run inside spinlock_acquire and spinlock_release, so they
+ * cannot use spinlocks themselves. Instead each record, and the table
+ * as a whole, is protected by a bare spinlock_data_t that we spin on
+ * directly. The hooks are always called with interrupts off, so that
+ * is safe.
+ *
+ * Records are found by open hashing and are never removed, only
+ * zeroed by "lockstat reset"; this lets a struct lock remember its
+ * record in lk_statrec and skip the lookup afterwards.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <lockstat.h>
+
+/* Number of records in the table. Must be a power of two. */
+#define LOCKSTAT_NRECS		256
+
+/* Length of the name kept for sleep locks, including the null. */
+#define LOCKSTAT_NAMELEN	24
+
+/* Default number of locks printed by the menu command. */
+#define LOCKSTAT_DEFTOP		10
+
+struct lockstat_rec {
+	volatile spinlock_data_t lr_lock;	/* protects the counters */
+	volatile bool lr_used;			/* key fields are valid */
+	const void *lr_site;			/* spinlock: caller of acquire */
+	char lr_name[LOCKSTAT_NAMELEN];		/* sleep lock: lock name */
+	unsigned lr_acquires;			/* acquisitions */
+	unsigned lr_contended;			/* of those, had to wait */
+	uint64_t lr_waittotal;			/* total wait, in ns */
+	uint32_t lr_waitmax;			/* longest wait, in ns */
+	uint64_t lr_holdtotal;			/* total hold time, in ns */
+};
+
+static struct lockstat_rec lockstat_recs[LOCKSTAT_NRECS];
+static volatile spinlock_data_t lockstat_tablelock = SPINLOCK_DATA_INITIALIZER;
+static volatile unsigned lockstat_dropped;	/* no room in the table */
+static volatile bool lockstat_enabled = false;
+
+static
+void
+lockstat_rawlock(volatile spinlock_data_t *sd)
+{
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+lockstat_rawunlock(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+}
+
+/*
+ * Current time in nanoseconds, or 0 if we aren't recording.
+ */
+uint64_t
+lockstat_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	if (!lockstat_enabled) {
+		return 0;
+	}
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+static
+unsigned
+lockstat_hash(const void *site, const char *name)
+{
+	unsigned h;
+
+	if (name == NULL) {
+		h = (uintptr_t)site;
+		return (h >> 2) ^ (h >> 11);
+	}
+	h = 5381;
+	while (*name != '\0') {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * Does NAME, cut to the length we keep, equal LR's name?
+ */
+static
+bool
+lockstat_samename(struct lockstat_rec *lr, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKSTAT_NAMELEN - 1; i++) {
+		if (lr->lr_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == '\0') {
+			return true;
+		}
+	}
+	return true;
+}
+
+static
+bool
+lockstat_match(struct lockstat_rec *lr, const void *site, const char *name)
+{
+	if (name == NULL) {
+		return lr->lr_site == site;
+	}
+	return lr->lr_site == NULL && lockstat_samename(lr, name);
+}
+
+/*
+ * Find the record for a spinlock call site (NAME is NULL) or a sleep
+ * lock name (SITE is NULL), making one if there isn't one yet.
+ * Returns NULL if the table is full.
+ */
+static
+struct lockstat_rec *
+lockstat_find(const void *site, const char *name)
+{
+	struct lockstat_rec *lr;
+	unsigned h, i, n, j;
+
+	h = lockstat_hash(site, name);
+
+	/* Records are never removed, so look without the table lock. */
+	for (n = 0; n < LOCKSTAT_NRECS; n++) {
+		lr = &lockstat_recs[(h + n) & (LOCKSTAT_NRECS - 1)];
+		if (!lr->lr_used) {
+			break;
+		}
+		if (lockstat_match(lr, site, name)) {
+			return lr;
+		}
+	}
+
+	/* Not there; look again under the lock and insert. */
+	lockstat_rawlock(&lockstat_tablelock);
+	for (n = 0; n < LOCKSTAT_NRECS; n++) {
+		i = (h + n) & (LOCKSTAT_NRECS - 1);
+		lr = &lockstat_recs[i];
+		if (!lr->lr_used) {
+			lr->lr_site = site;
+			if (name != NULL) {
+				for (j = 0; j < LOCKSTAT_NAMELEN - 1 &&
+					     name[j] != '\0'; j++) {
+					lr->lr_name[j] = name[j];
+				}
+				lr->lr_name[j] = '\0';
+			}
+			lr->lr_used = true;
+			lockstat_rawunlock(&lockstat_tablelock);
+			return lr;
+		}
+		if (lockstat_match(lr, site, name)) {
+			lockstat_rawunlock(&lockstat_tablelock);
+			return lr;
+		}
+	}
+	lockstat_dropped++;
+	lockstat_rawunlock(&lockstat_tablelock);
+	return NULL;
+}
+
+/*
+ * Count one acquisition in LR. NOW is the time it happened.
+ */
+static
+void
+lockstat_count(struct lockstat_rec *lr, uint64_t waitstart, uint64_t now)
+{
+	uint64_t wait;
+
+	lockstat_rawlock(&lr->lr_lock);
+	lr->lr_acquires++;
+	if (waitstart != 0) {
+		wait = now - waitstart;
+		if (wait > 0xffffffff) {
+			wait = 0xffffffff;
+		}
+		lr->lr_contended++;
+		lr->lr_waittotal += wait;
+		if (wait > lr->lr_waitmax) {
+			lr->lr_waitmax = wait;
+		}
+	}
+	lockstat_rawunlock(&lr->lr_lock);
+}
+
+/*
+ * Count a hold of STAMP up to now in LR.
+ */
+static
+void
+lockstat_hold(struct lockstat_rec *lr, uint64_t stamp)
+{
+	uint64_t now;
+
+	now = lockstat_now();
+	if (now == 0) {
+		/* turned off while the lock was held */
+		return;
+	}
+	lockstat_rawlock(&lr->lr_lock);
+	lr->lr_holdtotal += now - stamp;
+	lockstat_rawunlock(&lr->lr_lock);
+}
+
+/*
+ * Hooks: spinlock LK was just acquired by code at SITE.
+ */
+void
+lockstat_spin_acquired(struct spinlock *lk, const void *site,
+		       uint64_t waitstart)
+{
+	struct lockstat_rec *lr;
+	uint64_t now;
+
+	lk->lk_statrec = NULL;
+	lk->lk_stattime = 0;
+	if (!lockstat_enabled) {
+		return;
+	}
+	lr = lockstat_find(site, NULL);
+	if (lr == NULL) {
+		return;
+	}
+	now = lockstat_now();
+	lockstat_count(lr, waitstart, now);
+	lk->lk_statrec = lr;
+	lk->lk_stattime = now;
+}
+
+void
+lockstat_spin_released(struct spinlock *lk)
+{
+	if (lk->lk_stattime != 0) {
+		lockstat_hold(lk->lk_statrec, lk->lk_stattime);
+		lk->lk_stattime = 0;
+	}
+}
+
+/*
+ * Hooks: sleep lock LK was just acquired or is being released.
+ * Called with LK's spinlock held.
+ */
+void
+lockstat_lock_acquired(struct lock *lk, uint64_t waitstart)
+{
+	uint64_t now;
+
+	lk->lk_stattime = 0;
+	if (!lockstat_enabled) {
+		return;
+	}
+	if (lk->lk_statrec == NULL) {
+		lk->lk_statrec = lockstat_find(NULL, lk->lk_name);
+		if (lk->lk_statrec == NULL) {
+			return;
+		}
+	}
+	now = lockstat_now();
+	lockstat_count(lk->lk_statrec, waitstart, now);
+	lk->lk_stattime = now;
+}
+
+void
+lockstat_lock_released(struct lock *lk)
+{
+	if (lk->lk_stattime != 0) {
+		lockstat_hold(lk->lk_statrec, lk->lk_stattime);
+		lk->lk_stattime = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+lockstat_print(unsigned top)
+{
+	struct lockstat_rec *lr, *best;
+	bool printed[LOCKSTAT_NRECS];
+	unsigned i, n, bi;
+	char site[24];
+
+	bzero(printed, sizeof(printed));
+
+	kprintf("Lock statistics (%s), times in ns:\n",
+		lockstat_enabled ? "on" : "off");
+	kprintf("%-23s %9s %9s %10s %10s %10s\n", "lock", "acquires",
+		"contended", "avg wait", "max wait", "avg hold");
+
+	/* Selection of the top few by contended count; N is small. */
+	for (n = 0; n < top; n++) {
+		best = NULL;
+		bi = 0;
+		for (i = 0; i < LOCKSTAT_NRECS; i++) {
+			lr = &lockstat_recs[i];
+			if (!lr->lr_used || printed[i] ||
+			    lr->lr_acquires == 0) {
+				continue;
+			}
+			if (best == NULL ||
+			    lr->lr_contended > best->lr_contended ||
+			    (lr->lr_contended == best->lr_contended &&
+			     lr->lr_acquires > best->lr_acquires)) {
+				best = lr;
+				bi = i;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		printed[bi] = true;
+
+		if (best->lr_site != NULL) {
+			snprintf(site, sizeof(site), "spin@%p",
+				 best->lr_site);
+		}
+		kprintf("%-23s %9u %9u %10lu %10lu %10lu\n",
+			best->lr_site != NULL ? site : best->lr_name,
+			best->lr_acquires, best->lr_contended,
+			best->lr_contended == 0 ? 0UL : (unsigned long)
+			(best->lr_waittotal / best->lr_contended),
+			(unsigned long)best->lr_waitmax,
+			(unsigned long)
+			(best->lr_holdtotal / best->lr_acquires));
+	}
+	if (lockstat_dropped > 0) {
+		kprintf("(%u acquisitions not counted: table full)\n",
+			lockstat_dropped);
+	}
+}
+
+/*
+ * Menu command:
+ *    lockstat          print the 10 most contended locks
+ *    lockstat N        print the N most contended locks
+ *    lockstat on       start recording
+ *    lockstat off      stop recording
+ *    lockstat reset    clear everything recorded so far
+ */
+int
+lockstat_cmd(int nargs, char **args)
+{
+	struct lockstat_rec *lr;
+	bool wasenabled;
+	int spl, top;
+	unsigned i;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [on|off|reset|N]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		lockstat_enabled = true;
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		lockstat_enabled = false;
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		/* keep the keys; struct locks point at their records */
+		wasenabled = lockstat_enabled;
+		lockstat_enabled = false;
+		spl = splhigh();
+		for (i = 0; i < LOCKSTAT_NRECS; i++) {
+			lr = &lockstat_recs[i];
+			lockstat_rawlock(&lr->lr_lock);
+			lr->lr_acquires = 0;
+			lr->lr_contended = 0;
+			lr->lr_waittotal = 0;
+			lr->lr_waitmax = 0;
+			lr->lr_holdtotal = 0;
+			lockstat_rawunlock(&lr->lr_lock);
+		}
+		lockstat_dropped = 0;
+		splx(spl);
+		lockstat_enabled = wasenabled;
+		return 0;
+	}
+
+	top = LOCKSTAT_DEFTOP;
+	if (nargs == 2) {
+		top = atoi(args[1]);
+		if (top <= 0) {
+			kprintf("Usage: lockstat [on|off|reset|N]\n");
+			return EINVAL;
+		}
+	}
+	lockstat_print(top);
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Scheduler tracing. See schedtrace.h.
+ *
+ * Everything here is per-cpu and is only updated by its own cpu from
+ * inside thread_switch or hardclock, both of which run at splhigh, so
+ * no locking is needed to record. Printing reads other cpus' records
+ * unlocked; the numbers are a snapshot, which is all we want.
+ *
+ * Timestamps come from gettime(), which reads the hardware clock.
+ * That's not free, so it's only done while tracing is turned on.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <schedtrace.h>
+#include <platform/maxcpus.h>
+
+/* Size of the per-cpu ring buffer of recent switches. */
+#define SCHEDTRACE_RINGSIZE	64
+
+/* Latency histogram: <1us, then powers of two in us (last is open). */
+#define SCHEDTRACE_LATBUCKETS	16
+
+/* Run queue length histogram: 0 .. RQBUCKETS-2, and RQBUCKETS-1 or more */
+#define SCHEDTRACE_RQBUCKETS	16
+
+/* One entry in the ring buffer. */
+struct schedtrace_event {
+	uint32_t se_latency;		/* wakeup-to-run latency, in ns */
+	uint16_t se_rqlen;		/* run queue length at the switch */
+	uint8_t se_voluntary;		/* was the switch voluntary? */
+};
+
+/* Per-cpu trace state. */
+struct schedtrace_cpu {
+	unsigned sc_voluntary;		/* voluntary switches */
+	unsigned sc_involuntary;	/* involuntary switches */
+	unsigned sc_latcount;		/* latencies measured */
+	uint64_t sc_lattotal;		/* sum of same, in ns */
+	uint32_t sc_latmax;		/* largest of same, in ns */
+	unsigned sc_lat[SCHEDTRACE_LATBUCKETS];
+	unsigned sc_rqsamples;		/* run queue samples taken */
+	unsigned sc_rq[SCHEDTRACE_RQBUCKETS];
+	unsigned sc_ringpos;		/* total events ever recorded */
+	struct schedtrace_event sc_ring[SCHEDTRACE_RINGSIZE];
+};
+
+static struct schedtrace_cpu schedtrace_cpus[MAXCPUS];
+static volatile bool schedtrace_enabled = false;
+
+/*
+ * Current time in nanoseconds.
+ */
+static
+uint64_t
+schedtrace_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Get the trace state for the current cpu.
+ */
+static
+struct schedtrace_cpu *
+schedtrace_mycpu(void)
+{
+	KASSERT(curcpu->c_number < MAXCPUS);
+	return &schedtrace_cpus[curcpu->c_number];
+}
+
+/*
+ * Hook: thread T has just been made runnable.
+ */
+void
+schedtrace_runnable(struct thread *t)
+{
+	t->t_readytime = schedtrace_enabled ? schedtrace_now() : 0;
+}
+
+/*
+ * Hook: this cpu is about to switch from CUR to NEXT. VOLUNTARY is
+ * false if CUR is being preempted. RQLEN is the number of threads
+ * left on the run queue.
+ */
+void
+schedtrace_switch(struct thread *cur, struct thread *next,
+		  bool voluntary, unsigned rqlen)
+{
+	struct schedtrace_cpu *sc;
+	struct schedtrace_event *se;
+	uint64_t latency;
+	uint32_t us;
+	unsigned b;
+
+	(void)cur;
+
+	if (!schedtrace_enabled) {
+		return;
+	}
+	sc = schedtrace_mycpu();
+
+	if (voluntary) {
+		sc->sc_voluntary++;
+	}
+	else {
+		sc->sc_involuntary++;
+	}
+
+	latency = 0;
+	if (next->t_readytime != 0) {
+		latency = schedtrace_now() - next->t_readytime;
+		if (latency > 0xffffffff) {
+			latency = 0xffffffff;
+		}
+		next->t_readytime = 0;
+
+		sc->sc_latcount++;
+		sc->sc_lattotal += latency;
+		if (latency > sc->sc_latmax) {
+			sc->sc_latmax = latency;
+		}
+
+		us = (uint32_t)latency / 1000;
+		for (b = 0; us > 0 && b < SCHEDTRACE_LATBUCKETS - 1; b++) {
+			us >>= 1;
+		}
+		sc->sc_lat[b]++;
+	}
+
+	se = &sc->sc_ring[sc->sc_ringpos % SCHEDTRACE_RINGSIZE];
+	se->se_latency = latency;
+	se->se_rqlen = rqlen > 0xffff ? 0xffff : rqlen;
+	se->se_voluntary = voluntary;
+	sc->sc_ringpos++;
+}
+
+/*
+ * Hook: sample the run queue length. Called from hardclock.
+ */
+void
+schedtrace_sample(unsigned rqlen)
+{
+	struct schedtrace_cpu *sc;
+
+	if (!schedtrace_enabled) {
+		return;
+	}
+	sc = schedtrace_mycpu();
+
+	if (rqlen >= SCHEDTRACE_RQBUCKETS) {
+		rqlen = SCHEDTRACE_RQBUCKETS - 1;
+	}
+	sc->sc_rq[rqlen]++;
+	sc->sc_rqsamples++;
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+schedtrace_print_cpu(unsigned num, struct schedtrace_cpu *sc)
+{
+	unsigned i;
+
+	kprintf("cpu%u: %u voluntary, %u involuntary switches\n",
+		num, sc->sc_voluntary, sc->sc_involuntary);
+
+	if (sc->sc_latcount > 0) {
+		kprintf("  wakeup-to-run latency: %u samples, "
+			"avg %lu ns, max %lu ns\n",
+			sc->sc_latcount,
+			(unsigned long)(sc->sc_lattotal / sc->sc_latcount),
+			(unsigned long)sc->sc_latmax);
+		for (i=0; i<SCHEDTRACE_LATBUCKETS; i++) {
+			if (sc->sc_lat[i] == 0) {
+				continue;
+			}
+			if (i == 0) {
+				kprintf("    %8s < %6u us: %u\n", "",
+					1, sc->sc_lat[i]);
+			}
+			else if (i == SCHEDTRACE_LATBUCKETS - 1) {
+				kprintf("    %6u us <= %8s: %u\n",
+					1U << (i-1), "", sc->sc_lat[i]);
+			}
+			else {
+				kprintf("    %6u us .. %6u us: %u\n",
+					1U << (i-1), 1U << i, sc->sc_lat[i]);
+			}
+		}
+	}
+
+	if (sc->sc_rqsamples > 0) {
+		kprintf("  run queue length: %u samples\n", sc->sc_rqsamples);
+		for (i=0; i<SCHEDTRACE_RQBUCKETS; i++) {
+			if (sc->sc_rq[i] == 0) {
+				continue;
+			}
+			kprintf("    %2u%s: %u\n", i,
+				i == SCHEDTRACE_RQBUCKETS - 1 ? "+" : " ",
+				sc->sc_rq[i]);
+		}
+	}
+}
+
+static
+void
+schedtrace_print_ring(unsigned num, struct schedtrace_cpu *sc)
+{
+	struct schedtrace_event *se;
+	unsigned i, start;
+
+	start = 0;
+	if (sc->sc_ringpos > SCHEDTRACE_RINGSIZE) {
+		start = sc->sc_ringpos - SCHEDTRACE_RINGSIZE;
+	}
+
+	kprintf("cpu%u: last %u switches (oldest first):\n",
+		num, sc->sc_ringpos - start);
+	for (i=start; i<sc->sc_ringpos; i++) {
+		se = &sc->sc_ring[i % SCHEDTRACE_RINGSIZE];
+		kprintf("  %-11s latency %9u ns, run queue %u\n",
+			se->se_voluntary ? "voluntary" : "involuntary",
+			(unsigned)se->se_latency, (unsigned)se->se_rqlen);
+	}
+}
+
+/*
+ * Menu command:
+ *    st          print histograms
+ *    st on       start tracing
+ *    st off      stop tracing
+ *    st reset    clear everything recorded so far
+ *    st ring     print the recent-switch ring buffers
+ */
+int
+schedtrace_cmd(int nargs, char **args)
+{
+	struct schedtrace_cpu *sc;
+	bool wasenabled;
+	unsigned i;
+
+	if (nargs > 2) {
+		kprintf("Usage: st [on|off|reset|ring]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		schedtrace_enabled = true;
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		schedtrace_enabled = false;
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		wasenabled = schedtrace_enabled;
+		schedtrace_enabled = false;
+		bzero(schedtrace_cpus, sizeof(schedtrace_cpus));
+		schedtrace_enabled = wasenabled;
+		return 0;
+	}
+	if (nargs == 2 && strcmp(args[1], "ring") != 0) {
+		kprintf("Usage: st [on|off|reset|ring]\n");
+		return EINVAL;
+	}
+
+	kprintf("Scheduler trace (%s), HZ %d:\n",
+		schedtrace_enabled ? "on" : "off", HZ);
+	for (i=0; i<MAXCPUS; i++) {
+		sc = &schedtrace_cpus[i];
+		if (sc->sc_ringpos == 0 && sc->sc_rqsamples == 0) {
+			continue;
+		}
+		if (nargs == 2) {
+			schedtrace_print_ring(i, sc);
+		}
+		else {
+			schedtrace_print_cpu(i, sc);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Sequence locks. See seqlock.h; the fast paths are inline there.
+ */
+
+/* Make sure to build out-of-line versions of seqlock inline functions */
+#define SEQLOCK_INLINE   /* empty */
+
+#include <types.h>
+#include <lib.h>
+#include <seqlock.h>
+
+/*
+ * Initialize seqlock.
+ */
+void
+seqlock_init(struct seqlock *sl)
+{
+	spinlock_init(&sl->sl_lock);
+	sl->sl_seq = 0;
+}
+
+/*
+ * Clean up seqlock.
+ */
+void
+seqlock_cleanup(struct seqlock *sl)
+{
+	KASSERT((sl->sl_seq & 1) == 0);
+	spinlock_cleanup(&sl->sl_lock);
+}
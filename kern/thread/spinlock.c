@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,6 +51,22 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+	lk->lk_ticket = false;
+	spinlock_data_set(&lk->lk_serving, 0);
+#if OPT_LOCKSTAT
+	lk->lk_statrec = NULL;
+	lk->lk_stattime = 0;
+#endif
+}
+
+/*
+ * Initialize ticket spinlock.
+ */
+void
+spinlock_init_ticket(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_ticket = true;
 }
 
 /*
@@ -59,7 +76,38 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	if (lk->lk_ticket) {
+		KASSERT(spinlock_data_get(&lk->lk_lock) ==
+			spinlock_data_get(&lk->lk_serving));
+	}
+	else {
+		KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	}
+}
+
+/*
+ * Get a ticket lock: take the next ticket and wait for it to come up.
+ * The waiters all read lk_serving and only the holder writes it, so
+ * there's one atomic operation per acquire however many are waiting.
+ */
+static
+uint64_t
+spinlock_acquire_ticket(struct spinlock *lk)
+{
+	spinlock_data_t ticket;
+	uint64_t waitstart = 0;
+
+	do {
+		ticket = spinlock_data_get(&lk->lk_lock);
+	} while (spinlock_data_cas(&lk->lk_lock, ticket, ticket + 1)
+		 != ticket);
+
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+		if (waitstart == 0) {
+			waitstart = lockstat_now();
+		}
+	}
+	return waitstart;
 }
 
 /*
@@ -73,6 +121,7 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	uint64_t waitstart = 0;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +136,36 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+	if (lk->lk_ticket) {
+		waitstart = spinlock_acquire_ticket(lk);
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first before
+			 * doing test-and-set, to reduce bus contention.
+			 *
+			 * Test-and-set is a machine-level atomic operation
+			 * that writes 1 into the lock word and returns the
+			 * previous value. If that value was 0, the lock was
+			 * previously unheld and we now own it. If it was 1,
+			 * we don't.
+			 */
+			if (spinlock_data_get(&lk->lk_lock) != 0) {
+				if (waitstart == 0) {
+					waitstart = lockstat_now();
+				}
+				continue;
+			}
+			if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+				continue;
+			}
+			break;
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+	lockstat_spin_acquired(lk, __builtin_return_address(0), waitstart);
 }
 
 /*
@@ -121,8 +179,14 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+	lockstat_spin_released(lk);
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_ticket) {
+		spinlock_data_set(&lk->lk_serving, lk->lk_serving + 1);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
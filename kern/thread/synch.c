@@ -38,7 +38,22 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <lockdep.h>
+
+/*
+ * How many times an adaptive lock_acquire checks the lock before
+ * giving up and sleeping, even if the holder is still running.
+ */
+#define LOCK_SPIN_MAX   1000
+
+/*
+ * lk_thread of a FIFO lock that lock_release has handed to the next
+ * waiter, until that waiter wakes up and puts itself there.
+ */
+#define LOCK_HANDOFF    ((volatile struct thread *)1)
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +86,8 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+        sem->sem_fifo = false;
+        sem->sem_waiters = 0;
 
         return sem;
 }
@@ -101,6 +118,19 @@ P(struct semaphore *sem)
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&sem->sem_lock);
+        if (sem->sem_fifo && sem->sem_count == 0) {
+                /*
+                 * Queue up. V doesn't increment the count while
+                 * there are FIFO sleepers; it hands its count to the
+                 * one at the head of the wchan (which is FIFO), so
+                 * when we wake up we already have it.
+                 */
+                sem->sem_waiters++;
+                wchan_lock(sem->sem_wchan);
+                spinlock_release(&sem->sem_lock);
+                wchan_sleep(sem->sem_wchan);
+                return;
+        }
         while (sem->sem_count == 0) {
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
@@ -116,7 +146,7 @@ P(struct semaphore *sem)
 		 * strict ordering. Too bad. :-)
 		 *
 		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * ordering? (Answer: see the sem_fifo case.)
 		 */
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
@@ -136,13 +166,26 @@ V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
+        if (sem->sem_waiters > 0) {
+                /* FIFO: hand the count to the next sleeper. */
+                sem->sem_waiters--;
+        }
+        else {
+                sem->sem_count++;
+                KASSERT(sem->sem_count > 0);
+        }
 	wchan_wakeone(sem->sem_wchan);
 
 	spinlock_release(&sem->sem_lock);
 }
 
+void
+sem_setfifo(struct semaphore *sem)
+{
+        KASSERT(sem != NULL);
+        sem->sem_fifo = true;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
@@ -172,6 +215,15 @@ lock_create(const char *name)
 
         spinlock_init(&lock->lk_lock);
         lock->lk_thread = NULL;
+        lock->lk_cpu = NULL;
+        lock->lk_adaptive = true;
+        lock->lk_fifo = false;
+        lock->lk_waiters = 0;
+#if OPT_LOCKSTAT
+        lock->lk_statrec = NULL;
+        lock->lk_stattime = 0;
+#endif
+        lockdep_lock_init(lock, __builtin_return_address(0));
         return lock;
 }
 
@@ -187,14 +239,71 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Is HOLDER, which held LOCK a moment ago, still running on another
+ * cpu? This peeks at other cpus' c_curthread without locking, so it's
+ * only a guess, but a wrong guess costs at most some spinning or an
+ * unnecessary sleep.
+ */
+static
+bool
+lock_holder_running(struct lock *lock, volatile struct thread *holder)
+{
+        volatile struct cpu *c = lock->lk_cpu;
+
+        return c != NULL && c != curcpu->c_self &&
+                c->c_curthread == holder && !c->c_isidle;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+        volatile struct thread *holder;
+        unsigned spins = 0;
+        uint64_t waitstart = 0;
+
         KASSERT(!lock_do_i_hold(lock));
         KASSERT(curthread->t_in_interrupt == false);
+        lockdep_lock_acquire(lock);
 
         spinlock_acquire(&lock->lk_lock);
+        if (lock->lk_fifo && lock->lk_thread != NULL) {
+                /*
+                 * Queue up. lock_release gives the lock to the
+                 * thread at the head of the wchan, and nobody else
+                 * can take it meanwhile, so when we wake up it's
+                 * ours.
+                 */
+                waitstart = lockstat_now();
+                lock->lk_waiters++;
+                wchan_lock(lock->lk_wchan);
+                spinlock_release(&lock->lk_lock);
+                wchan_sleep(lock->lk_wchan);
+                spinlock_acquire(&lock->lk_lock);
+                KASSERT(lock->lk_thread == LOCK_HANDOFF);
+                lock->lk_thread = NULL;
+        }
         while (lock->lk_thread != NULL) {
+                if (waitstart == 0) {
+                        waitstart = lockstat_now();
+                }
+                holder = lock->lk_thread;
+                if (lock->lk_adaptive && spins < LOCK_SPIN_MAX &&
+                    lock_holder_running(lock, holder)) {
+                        /*
+                         * Spin with interrupts on, watching the
+                         * lock without its spinlock, until the
+                         * holder lets go or stops running.
+                         */
+                        spinlock_release(&lock->lk_lock);
+                        while (lock->lk_thread == holder &&
+                               spins < LOCK_SPIN_MAX &&
+                               lock_holder_running(lock, holder)) {
+                                spins++;
+                        }
+                        spinlock_acquire(&lock->lk_lock);
+                        continue;
+                }
                 wchan_lock(lock->lk_wchan);
                 spinlock_release(&lock->lk_lock);
                 wchan_sleep(lock->lk_wchan);
@@ -202,6 +311,8 @@ lock_acquire(struct lock *lock)
         }
         KASSERT(lock->lk_thread == NULL); 
         lock->lk_thread = curthread;
+        lock->lk_cpu = curcpu->c_self;
+        lockstat_lock_acquired(lock, waitstart);
         spinlock_release(&lock->lk_lock);
 }
 
@@ -209,10 +320,19 @@ void
 lock_release(struct lock *lock)
 {
         KASSERT(lock_do_i_hold(lock));
+        lockdep_lock_release(lock);
 
         spinlock_acquire(&lock->lk_lock);
-        lock->lk_thread = NULL;
-        KASSERT(lock->lk_thread == NULL);
+        lockstat_lock_released(lock);
+        lock->lk_cpu = NULL;
+        if (lock->lk_waiters > 0) {
+                /* FIFO: hand the lock to the next sleeper. */
+                lock->lk_waiters--;
+                lock->lk_thread = LOCK_HANDOFF;
+        }
+        else {
+                lock->lk_thread = NULL;
+        }
         wchan_wakeone(lock->lk_wchan);
         spinlock_release(&lock->lk_lock);
 
@@ -226,6 +346,21 @@ lock_do_i_hold(struct lock *lock)
         return (lock->lk_thread == curthread);        
 }
 
+void
+lock_setadaptive(struct lock *lock, bool adaptive)
+{
+        KASSERT(lock != NULL);
+        lock->lk_adaptive = adaptive;
+}
+
+void
+lock_setfifo(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+        KASSERT(lock->lk_thread == NULL);
+        lock->lk_fifo = true;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -302,3 +437,250 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 
         KASSERT(lock_do_i_hold(lock));
 }
+
+////////////////////////////////////////////////////////////
+//
+// Keyed CV
+
+struct kcv *
+kcv_create(const char *name, unsigned nkeys)
+{
+        struct kcv *kcv;
+        unsigned i;
+
+        KASSERT(nkeys > 0);
+
+        kcv = kmalloc(sizeof(struct kcv));
+        if (kcv == NULL) {
+                return NULL;
+        }
+
+        kcv->kcv_name = kstrdup(name);
+        if (kcv->kcv_name == NULL) {
+                kfree(kcv);
+                return NULL;
+        }
+
+        kcv->kcv_wchans = kmalloc(nkeys * sizeof(struct wchan *));
+        if (kcv->kcv_wchans == NULL) {
+                kfree(kcv->kcv_name);
+                kfree(kcv);
+                return NULL;
+        }
+        for (i = 0; i < nkeys; i++) {
+                kcv->kcv_wchans[i] = wchan_create(kcv->kcv_name);
+                if (kcv->kcv_wchans[i] == NULL) {
+                        while (i-- > 0) {
+                                wchan_destroy(kcv->kcv_wchans[i]);
+                        }
+                        kfree(kcv->kcv_wchans);
+                        kfree(kcv->kcv_name);
+                        kfree(kcv);
+                        return NULL;
+                }
+        }
+        kcv->kcv_nkeys = nkeys;
+
+        return kcv;
+}
+
+void
+kcv_destroy(struct kcv *kcv)
+{
+        unsigned i;
+
+        KASSERT(kcv != NULL);
+
+        for (i = 0; i < kcv->kcv_nkeys; i++) {
+                wchan_destroy(kcv->kcv_wchans[i]);
+        }
+        kfree(kcv->kcv_wchans);
+        kfree(kcv->kcv_name);
+        kfree(kcv);
+}
+
+void
+kcv_wait(struct kcv *kcv, struct lock *lock, unsigned key)
+{
+        KASSERT(kcv != NULL);
+        KASSERT(key < kcv->kcv_nkeys);
+        KASSERT(lock_do_i_hold(lock));
+
+        wchan_lock(kcv->kcv_wchans[key]);
+        lock_release(lock);
+        wchan_sleep(kcv->kcv_wchans[key]);
+        lock_acquire(lock);
+}
+
+void
+kcv_signal(struct kcv *kcv, struct lock *lock, unsigned key)
+{
+        KASSERT(kcv != NULL);
+        KASSERT(key < kcv->kcv_nkeys);
+        KASSERT(lock_do_i_hold(lock));
+
+        wchan_wakeone(kcv->kcv_wchans[key]);
+}
+
+void
+kcv_broadcast(struct kcv *kcv, struct lock *lock, unsigned key)
+{
+        KASSERT(kcv != NULL);
+        KASSERT(key < kcv->kcv_nkeys);
+        KASSERT(lock_do_i_hold(lock));
+
+        wchan_wakeall(kcv->kcv_wchans[key]);
+}
+
+void
+kcv_broadcastall(struct kcv *kcv, struct lock *lock)
+{
+        unsigned i;
+
+        KASSERT(kcv != NULL);
+        KASSERT(lock_do_i_hold(lock));
+
+        for (i = 0; i < kcv->kcv_nkeys; i++) {
+                wchan_wakeall(kcv->kcv_wchans[i]);
+        }
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL) {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_writerswaiting = 0;
+        rw->rw_writer = NULL;
+        lockdep_rwlock_init(rw, __builtin_return_address(0));
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_writerswaiting == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+        lockdep_rwlock_acquire(rw);
+
+        spinlock_acquire(&rw->rw_lock);
+        /* Wait behind both the writer and any writers waiting. */
+        while (rw->rw_writer != NULL || rw->rw_writerswaiting > 0) {
+                wchan_lock(rw->rw_readwchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_readwchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        lockdep_rwlock_release(rw);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_writerswaiting > 0) {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+        lockdep_rwlock_acquire(rw);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writerswaiting++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                wchan_lock(rw->rw_writewchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_writewchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_writerswaiting--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rwlock_do_i_hold_write(rw));
+        lockdep_rwlock_release(rw);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        if (rw->rw_writerswaiting > 0) {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        else {
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        return (rw->rw_writer == curthread);
+}
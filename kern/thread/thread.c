@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <schedtrace.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,6 +58,9 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Maximum number of exited threads kept for reuse on each cpu. */
+#define THREAD_CACHE_MAX 16
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -112,34 +116,54 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set the name of a thread. Names that fit go in t_namebuf, which
+ * saves a kmalloc per thread; longer ones are kstrdup'd.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Release the name set by thread_setname.
+ */
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
 	}
+	thread->t_name = NULL;
+}
+
+/*
+ * Initialize the fields of a thread that start fresh with each new
+ * thread, whether the structure is newly allocated or recycled from
+ * the thread cache. The name, stack, and list node are handled by
+ * the callers.
+ */
+static
+void
+thread_reset(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -149,7 +173,47 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+#if OPT_SCHEDTRACE
+	thread->t_readytime = 0;
+#endif
+
+#if OPT_LOCKDEP
+	thread->t_lockdep_nheld = 0;
+#endif
+
+#if OPT_A3
+	thread->t_tid = 0;
+#endif
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_wakeupnext = NULL;
+	thread->t_stack = NULL;
+	thread_reset(thread);
 
 	return thread;
 }
@@ -179,11 +243,16 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
+	c->c_wakeups_sent = 0;
+	c->c_wakeup_retries = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	spinlock_init_ticket(&c->c_runqueue_lock);
+
+	spinlock_data_set(&c->c_wakeups, 0);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -258,10 +327,84 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
 	kfree(thread);
 }
 
+/*
+ * Thread cache.
+ *
+ * Rather than freeing exited threads, exorcise() parks up to
+ * THREAD_CACHE_MAX of them, stacks and all, on a per-cpu list, and
+ * thread_fork takes them back off again. This keeps the struct
+ * thread and STACK_SIZE allocations out of the fork/exit path.
+ *
+ * Cached stacks keep their guard band stamped, and it is checked
+ * both going in and coming out of the cache.
+ *
+ * The cache is only touched by its own cpu, at splhigh, so it needs
+ * no lock.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	struct threadlist *cache;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_state == S_ZOMBIE);
+
+	cache = &curcpu->c_threadcache;
+	if (thread->t_stack == NULL || cache->tl_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	thread_checkstack(thread);
+	thread_checkstack_init(thread);
+
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread_freename(thread);
+	thread->t_wchan_name = "CACHED";
+
+	/* LIFO, so the most recently used stack is reused first */
+	threadlist_addhead(cache, thread);
+	return true;
+}
+
+/*
+ * Get a thread, with stack, from the current cpu's thread cache.
+ * Returns NULL if the cache is empty.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	DEBUGASSERT(name != NULL);
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		/* the cached thread is a clean zombie; tear it down as one */
+		thread_destroy(thread);
+		return NULL;
+	}
+
+	thread_checkstack(thread);
+	thread_reset(thread);
+
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
@@ -277,7 +420,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -306,6 +451,7 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = NULL;
 	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	spinlock_data_set(&curcpu->c_wakeups, 0);
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +572,73 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Remote wakeup lists.
+ *
+ * Rather than taking another cpu's run queue lock to wake a thread
+ * there, push it onto that cpu's c_wakeups list. This is a
+ * multiple-producer, single-consumer stack: any cpu may push, using
+ * compare-and-swap, but only the owning cpu takes things off, and it
+ * always takes the whole list at once. So there's no ABA problem.
+ */
+static
+void
+thread_wakeups_push(struct cpu *targetcpu, struct thread *target)
+{
+	spinlock_data_t old;
+	int spl;
+
+	/* Stay on this cpu so the statistics stay consistent. */
+	spl = splhigh();
+	curcpu->c_wakeups_sent++;
+	while (1) {
+		old = spinlock_data_get(&targetcpu->c_wakeups);
+		target->t_wakeupnext = (struct thread *)old;
+		if (spinlock_data_cas(&targetcpu->c_wakeups, old,
+				      (spinlock_data_t)target) == old) {
+			break;
+		}
+		curcpu->c_wakeup_retries++;
+	}
+	splx(spl);
+}
+
+/*
+ * Move the threads on our remote wakeup list onto our run queue, in
+ * the order they were woken. The run queue must be locked.
+ */
+static
+void
+thread_wakeups_splice(void)
+{
+	struct thread *t, *next, *fifo;
+	spinlock_data_t old;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	/* Detach the whole list. */
+	do {
+		old = spinlock_data_get(&curcpu->c_wakeups);
+		if (old == 0) {
+			return;
+		}
+	} while (spinlock_data_cas(&curcpu->c_wakeups, old, 0) != old);
+
+	/* It's newest first; reverse it. */
+	fifo = NULL;
+	for (t = (struct thread *)old; t != NULL; t = next) {
+		next = t->t_wakeupnext;
+		t->t_wakeupnext = fifo;
+		fifo = t;
+	}
+
+	for (t = fifo; t != NULL; t = next) {
+		next = t->t_wakeupnext;
+		t->t_wakeupnext = NULL;
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -438,9 +651,27 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
+	schedtrace_runnable(target);
+
+	if (!already_have_lock && targetcpu != curcpu->c_self) {
+		/*
+		 * Another cpu: don't touch its run queue, use its
+		 * wakeup list. Checking c_isidle without the lock is
+		 * safe: thread_switch sets c_isidle before it looks
+		 * at the wakeup list, and we look at c_isidle after
+		 * pushing. So either it sees our thread, or we see
+		 * that it's idle and kick it.
+		 */
+		thread_wakeups_push(targetcpu, target);
+		if (targetcpu->c_isidle) {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+		return;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
@@ -487,18 +718,22 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Reuse a cached thread and stack if there is one */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -570,8 +805,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and pick up threads woken by other cpus. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_wakeups_splice();
 
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
@@ -625,13 +861,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * idle. Other cpus look at it without the runqueue lock when
+	 * pushing remote wakeups (see thread_make_runnable), so this
+	 * can cost a spurious IPI_UNIDLE, but nothing worse.
+	 *
+	 * c_isidle must be set before we check the remote wakeup list
+	 * each time around.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
+		thread_wakeups_splice();
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
@@ -641,6 +882,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Preemption from the timer interrupt is the involuntary case. */
+	schedtrace_switch(cur, next,
+			  newstate != S_READY || !cur->t_in_interrupt,
+			  curcpu->c_runqueue.tl_count);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -866,10 +1112,11 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
 		if (c == curcpu->c_self) {
+			thread_wakeups_splice();
 			my_count = c->c_runqueue.tl_count;
 		}
+		total_count += c->c_runqueue.tl_count;
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
@@ -957,6 +1204,26 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Remote wakeup statistics, for benchmarking.
+ *
+ * The counters are only updated by their own cpus, so the sums are
+ * only a snapshot.
+ */
+void
+thread_wakeupstats(unsigned *sent, unsigned *retries)
+{
+	unsigned i;
+	struct cpu *c;
+
+	*sent = *retries = 0;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		*sent += c->c_wakeups_sent;
+		*retries += c->c_wakeup_retries;
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <poll.h>
 
 /*
  * Called for each open().
@@ -293,6 +294,22 @@ dev_namefile(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Devices without a d_poll never make anyone wait (the disks) or
+ * never have anything to offer (null:), so they're always ready.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_poll == NULL) {
+		return vopnull_poll(v, events, pe, revents);
+	}
+	return d->d_poll(d, events, pe, revents);
+}
+
 /*
  * Operations that are completely meaningless on devices.
  */
@@ -430,6 +447,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	dev_mmap,
 	dev_truncate,
 	dev_namefile,
+	dev_poll,
 	null_creat,
 	null_symlink,
 	null_mkdir,
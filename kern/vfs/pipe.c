@@ -0,0 +1,606 @@
+/*
+ * Anonymous pipes. See pipe.h.
+ *
+ * The data lives in a PIPE_SIZE-byte ring. p_head counts bytes ever
+ * read and is only written by the reader; p_tail counts bytes ever
+ * written and is only written by the writer. Neither side locks the
+ * other out: the writer fills the ring and then moves p_tail, the
+ * reader empties it and then moves p_head, with memory barriers in
+ * between, so in the usual one-reader, one-writer case a transfer
+ * takes no shared lock at all. Several readers (or writers) of one
+ * pipe queue up on p_rlock (or p_wlock) and go one at a time.
+ *
+ * A reader that finds the ring empty sleeps on p_rwchan, and a writer
+ * that finds it full sleeps on p_wwchan. To avoid lost wakeups the
+ * sleeper sets its flag, then looks again with the wchan locked; the
+ * other side moves its counter, then looks at the flag. The barriers
+ * on both sides mean at least one of them sees the other's change.
+ * Closing an end always wakes the other side.
+ *
+ * For poll, each end has a pollhead, woken whenever the other side
+ * moves its counter or closes: data coming in or writers going away
+ * for the read end, room freed up or readers going away for the write
+ * end. When no one is polling that costs a barrier and a load.
+ *
+ * Each end is its own vnode so that we find out when all the readers
+ * or all the writers are gone: vop_close is called on the last close
+ * of that end. The pipe is freed once both vnodes are reclaimed.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+struct pipe {
+	char *p_buf;			/* PIPE_SIZE bytes */
+	volatile unsigned p_head;	/* bytes read, ever */
+	volatile unsigned p_tail;	/* bytes written, ever */
+
+	struct lock *p_rlock;		/* one reader at a time */
+	struct lock *p_wlock;		/* one writer at a time */
+	struct wchan *p_rwchan;		/* reader waits for data */
+	struct wchan *p_wwchan;		/* writer waits for room */
+	volatile bool p_rsleeping;	/* reader is (about to be) on p_rwchan */
+	volatile bool p_wsleeping;	/* writer is (about to be) on p_wwchan */
+	volatile bool p_rclosed;	/* no readers left */
+	volatile bool p_wclosed;	/* no writers left */
+	struct pollhead p_rph;		/* pollers of the read end */
+	struct pollhead p_wph;		/* pollers of the write end */
+
+	struct spinlock p_lock;		/* protects p_nvnodes */
+	unsigned p_nvnodes;		/* ends not yet reclaimed */
+	struct vnode p_rvn;
+	struct vnode p_wvn;
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	if (p->p_wwchan != NULL) {
+		wchan_destroy(p->p_wwchan);
+	}
+	if (p->p_rwchan != NULL) {
+		wchan_destroy(p->p_rwchan);
+	}
+	if (p->p_wlock != NULL) {
+		lock_destroy(p->p_wlock);
+	}
+	if (p->p_rlock != NULL) {
+		lock_destroy(p->p_rlock);
+	}
+	if (p->p_buf != NULL) {
+		kfree(p->p_buf);
+	}
+	pollhead_cleanup(&p->p_wph);
+	pollhead_cleanup(&p->p_rph);
+	spinlock_cleanup(&p->p_lock);
+	kfree(p);
+}
+
+/*
+ * Copy up to LEN bytes between the ring, starting at ring position
+ * POS, and UIO, going around the end of the ring if need be.
+ */
+static
+int
+pipe_uiomove(struct pipe *p, unsigned pos, size_t len, struct uio *uio)
+{
+	size_t start, first;
+	int result;
+
+	start = pos % PIPE_SIZE;
+	first = len < PIPE_SIZE - start ? len : PIPE_SIZE - start;
+	result = uiomove(p->p_buf + start, first, uio);
+	if (result == 0 && first < len) {
+		result = uiomove(p->p_buf, len - first, uio);
+	}
+	return result;
+}
+
+/*
+ * Sleep on WC until *COUNTER moves away from OLD or *CLOSED is set.
+ * SLEEPING is the caller's flag.
+ */
+static
+void
+pipe_sleep(struct wchan *wc, volatile bool *sleeping,
+	   volatile unsigned *counter, unsigned old, volatile bool *closed)
+{
+	wchan_lock(wc);
+	*sleeping = true;
+	membar_any_any();
+	if (*counter == old && !*closed) {
+		wchan_sleep(wc);
+	}
+	else {
+		wchan_unlock(wc);
+	}
+	*sleeping = false;
+}
+
+/*
+ * Tell the other side we moved our counter, if it's waiting for that.
+ */
+static
+void
+pipe_wake(struct wchan *wc, volatile bool *sleeping)
+{
+	membar_any_any();
+	if (*sleeping) {
+		wchan_wakeall(wc);
+	}
+}
+
+/*
+ * Read whatever is there, up to what was asked for, waiting only if
+ * there's nothing at all.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail;
+	size_t avail, len;
+	bool gotsome = false;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(v == &p->p_rvn);
+
+	lock_acquire(p->p_rlock);
+	head = p->p_head;
+	while (uio->uio_resid > 0) {
+		tail = p->p_tail;
+		/* read the tail before the data it covers */
+		membar_load_load();
+		avail = tail - head;
+		if (avail == 0) {
+			if (gotsome) {
+				break;
+			}
+			if (p->p_wclosed) {
+				/*
+				 * The last write may have landed between
+				 * our tail and the close; only EOF if the
+				 * tail after the close is still ours.
+				 */
+				membar_load_load();
+				if (p->p_tail != head) {
+					continue;
+				}
+				break;
+			}
+			pipe_sleep(p->p_rwchan, &p->p_rsleeping,
+				   &p->p_tail, tail, &p->p_wclosed);
+			continue;
+		}
+
+		len = avail < uio->uio_resid ? avail : uio->uio_resid;
+		result = pipe_uiomove(p, head, len, uio);
+		if (result) {
+			break;
+		}
+		/* finish with the data before giving its space back */
+		membar_any_any();
+		head += len;
+		p->p_head = head;
+		gotsome = true;
+		pipe_wake(p->p_wwchan, &p->p_wsleeping);
+		pollhead_wakeup(&p->p_wph);
+	}
+	lock_release(p->p_rlock);
+	return result;
+}
+
+/*
+ * Write everything, waiting for room as needed, unless the readers
+ * go away. If some was written by then, the short count says so.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail;
+	size_t room, len;
+	bool putsome = false;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(v == &p->p_wvn);
+
+	lock_acquire(p->p_wlock);
+	tail = p->p_tail;
+	while (uio->uio_resid > 0) {
+		if (p->p_rclosed) {
+			if (!putsome) {
+				result = EPIPE;
+			}
+			break;
+		}
+		head = p->p_head;
+		/* don't write into space before the reader is done with it */
+		membar_any_any();
+		room = PIPE_SIZE - (tail - head);
+		if (room == 0) {
+			pipe_sleep(p->p_wwchan, &p->p_wsleeping,
+				   &p->p_head, head, &p->p_rclosed);
+			continue;
+		}
+
+		len = room < uio->uio_resid ? room : uio->uio_resid;
+		result = pipe_uiomove(p, tail, len, uio);
+		if (result) {
+			break;
+		}
+		/* the data goes out before the tail that covers it */
+		membar_store_store();
+		tail += len;
+		p->p_tail = tail;
+		putsome = true;
+		pipe_wake(p->p_rwchan, &p->p_rsleeping);
+		pollhead_wakeup(&p->p_rph);
+	}
+	lock_release(p->p_wlock);
+	return result;
+}
+
+/*
+ * Last close of one end. Let anyone waiting on the other end know.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	if (v == &p->p_rvn) {
+		p->p_rclosed = true;
+		membar_any_any();
+		wchan_wakeall(p->p_wwchan);
+		pollhead_wakeup(&p->p_wph);
+	}
+	else {
+		p->p_wclosed = true;
+		membar_any_any();
+		wchan_wakeall(p->p_rwchan);
+		pollhead_wakeup(&p->p_rph);
+	}
+	return 0;
+}
+
+/*
+ * Last reference to one end. Free the pipe after the second.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	unsigned left;
+
+	vnode_cleanup(v);
+
+	spinlock_acquire(&p->p_lock);
+	KASSERT(p->p_nvnodes > 0);
+	left = --p->p_nvnodes;
+	spinlock_release(&p->p_lock);
+
+	if (left == 0) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * The read end is readable if there's data, and hung up if there are
+ * no writers; the write end is writable if there's room, and in error
+ * if there are no readers. Either way reading or writing won't wait.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail;
+	bool wclosed;
+
+	if (pe != NULL) {
+		pollhead_add(v == &p->p_rvn ? &p->p_rph : &p->p_wph, pe);
+	}
+
+	head = p->p_head;
+	*revents = 0;
+	if (v == &p->p_rvn) {
+		/* closed, then the tail: a hangup never hides data */
+		wclosed = p->p_wclosed;
+		membar_load_load();
+		tail = p->p_tail;
+		if (tail != head) {
+			*revents |= events & POLLIN;
+		}
+		if (wclosed) {
+			*revents |= POLLHUP;
+		}
+	}
+	else {
+		tail = p->p_tail;
+		if (tail - head < PIPE_SIZE) {
+			*revents |= events & POLLOUT;
+		}
+		if (p->p_rclosed) {
+			*revents |= POLLERR;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The size is what's waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_size = p->p_tail - p->p_head;
+	statbuf->st_blksize = PIPE_SIZE;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+/*
+ * Operations that make no sense on pipes.
+ */
+
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_nullio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EUNIMP;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_nullio,	/* readlink */
+	pipe_nullio,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_nullio,	/* namefile */
+	pipe_poll,
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+int
+pipe_create(struct vnode **rvn, struct vnode **wvn)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_head = p->p_tail = 0;
+	p->p_rsleeping = p->p_wsleeping = false;
+	p->p_rclosed = p->p_wclosed = false;
+	spinlock_init(&p->p_lock);
+	p->p_nvnodes = 0;
+	pollhead_init(&p->p_rph);
+	pollhead_init(&p->p_wph);
+
+	p->p_buf = kmalloc(PIPE_SIZE);
+	p->p_rlock = lock_create("pipe_read");
+	p->p_wlock = lock_create("pipe_write");
+	p->p_rwchan = wchan_create("pipe_read");
+	p->p_wwchan = wchan_create("pipe_write");
+	if (p->p_buf == NULL || p->p_rlock == NULL || p->p_wlock == NULL ||
+	    p->p_rwchan == NULL || p->p_wwchan == NULL) {
+		pipe_destroy(p);
+		return ENOMEM;
+	}
+
+	result = VOP_INIT(&p->p_rvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		pipe_destroy(p);
+		return result;
+	}
+	result = VOP_INIT(&p->p_wvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		VOP_CLEANUP(&p->p_rvn);
+		pipe_destroy(p);
+		return result;
+	}
+	p->p_nvnodes = 2;
+
+	/* as if opened, so vfs_close does the rest */
+	VOP_INCOPEN(&p->p_rvn);
+	VOP_INCOPEN(&p->p_wvn);
+
+	*rvn = &p->p_rvn;
+	*wvn = &p->p_wvn;
+	return 0;
+}
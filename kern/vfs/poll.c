@@ -0,0 +1,388 @@
+/*
+ * Readiness notification. See poll.h.
+ *
+ * Lock order: poll_timerlock, then a pollhead's ph_lock, then a
+ * poller's pl_lock, then the poller's wchan. A waker holds ph_lock
+ * while it touches the pollers on the list, so once poller_destroy
+ * has taken a pollent off (under the same lock) nobody can be about
+ * to wake that poller, and it can be freed.
+ *
+ * Timeouts are done by hardclock: pollers with a deadline go on
+ * poll_timed, and while that's not empty each hardclock looks at the
+ * time and wakes those that are due. So a timeout is good to within a
+ * clock tick, and costs nothing when no one is using one.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <poll.h>
+
+struct poller {
+	struct spinlock pl_lock;
+	struct wchan *pl_wchan;
+	struct pollent *pl_ready;	/* fired pollents */
+	bool pl_sleeping;		/* on pl_wchan */
+	bool pl_timedout;
+
+	/* protected by poll_timerlock */
+	bool pl_timed;			/* on poll_timed */
+	time_t pl_secs;			/* deadline */
+	uint32_t pl_nsecs;
+	struct poller *pl_timednext;
+	struct poller *pl_timedprev;
+
+	unsigned pl_nents;
+	struct pollent *pl_ents;
+};
+
+static struct spinlock poll_timerlock = SPINLOCK_INITIALIZER;
+static struct poller *volatile poll_timed;
+
+////////////////////////////////////////////////////////////
+// pollheads
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_first = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	KASSERT(ph->ph_first == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+void
+pollhead_add(struct pollhead *ph, struct pollent *pe)
+{
+	KASSERT(pe->pe_head == NULL);
+
+	spinlock_acquire(&ph->ph_lock);
+	pe->pe_head = ph;
+	pe->pe_prev = NULL;
+	pe->pe_next = ph->ph_first;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prev = pe;
+	}
+	ph->ph_first = pe;
+	spinlock_release(&ph->ph_lock);
+
+	/* be on the list before the caller looks at the state */
+	membar_any_any();
+}
+
+static
+void
+pollhead_remove(struct pollent *pe)
+{
+	struct pollhead *ph = pe->pe_head;
+
+	spinlock_acquire(&ph->ph_lock);
+	if (pe->pe_prev != NULL) {
+		pe->pe_prev->pe_next = pe->pe_next;
+	}
+	else {
+		ph->ph_first = pe->pe_next;
+	}
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prev = pe->pe_prev;
+	}
+	spinlock_release(&ph->ph_lock);
+	pe->pe_head = NULL;
+}
+
+/*
+ * Put PE on its poller's ready list, and wake the poller if it's
+ * asleep.
+ */
+static
+void
+pollent_fire(struct pollent *pe)
+{
+	struct poller *pl = pe->pe_poller;
+	bool wake;
+
+	spinlock_acquire(&pl->pl_lock);
+	if (!pe->pe_fired) {
+		pe->pe_fired = true;
+		pe->pe_readynext = pl->pl_ready;
+		pl->pl_ready = pe;
+	}
+	wake = pl->pl_sleeping;
+	spinlock_release(&pl->pl_lock);
+
+	if (wake) {
+		wchan_wakeall(pl->pl_wchan);
+	}
+}
+
+/*
+ * Pollents stay on the pollhead after firing; the poller takes them
+ * off when it's done. This is called on every read and write of a
+ * pipe, so when nobody is polling it's one unlocked look at the list.
+ */
+void
+pollhead_wakeup(struct pollhead *ph)
+{
+	struct pollent *pe;
+
+	/* the caller's state change goes before the look at the list */
+	membar_any_any();
+	if (ph->ph_first == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pe = ph->ph_first; pe != NULL; pe = pe->pe_next) {
+		pollent_fire(pe);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+////////////////////////////////////////////////////////////
+// pollers
+
+struct poller *
+poller_create(unsigned nents)
+{
+	struct poller *pl;
+	unsigned i;
+
+	pl = kmalloc(sizeof(struct poller));
+	if (pl == NULL) {
+		return NULL;
+	}
+	pl->pl_ents = kmalloc(nents * sizeof(struct pollent));
+	if (pl->pl_ents == NULL && nents > 0) {
+		kfree(pl);
+		return NULL;
+	}
+	pl->pl_wchan = wchan_create("poll");
+	if (pl->pl_wchan == NULL) {
+		kfree(pl->pl_ents);
+		kfree(pl);
+		return NULL;
+	}
+	spinlock_init(&pl->pl_lock);
+	pl->pl_ready = NULL;
+	pl->pl_sleeping = false;
+	pl->pl_timedout = false;
+	pl->pl_timed = false;
+	pl->pl_nents = nents;
+	for (i = 0; i < nents; i++) {
+		pl->pl_ents[i].pe_head = NULL;
+		pl->pl_ents[i].pe_poller = pl;
+		pl->pl_ents[i].pe_fired = false;
+		pl->pl_ents[i].pe_index = i;
+	}
+	return pl;
+}
+
+struct pollent *
+poller_ent(struct poller *pl, unsigned index)
+{
+	KASSERT(index < pl->pl_nents);
+	return &pl->pl_ents[index];
+}
+
+/*
+ * Wake PL because its time is up.
+ */
+static
+void
+poller_timeout(struct poller *pl)
+{
+	bool wake;
+
+	spinlock_acquire(&pl->pl_lock);
+	pl->pl_timedout = true;
+	wake = pl->pl_sleeping;
+	spinlock_release(&pl->pl_lock);
+
+	if (wake) {
+		wchan_wakeall(pl->pl_wchan);
+	}
+}
+
+/*
+ * Put PL on poll_timed, due TIMEOUT_MS from now.
+ */
+static
+void
+poller_settimer(struct poller *pl, int timeout_ms)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	secs += timeout_ms / 1000;
+	nsecs += (timeout_ms % 1000) * 1000000;
+	if (nsecs >= 1000000000) {
+		secs++;
+		nsecs -= 1000000000;
+	}
+
+	spinlock_acquire(&poll_timerlock);
+	pl->pl_secs = secs;
+	pl->pl_nsecs = nsecs;
+	pl->pl_timedprev = NULL;
+	pl->pl_timednext = poll_timed;
+	if (pl->pl_timednext != NULL) {
+		pl->pl_timednext->pl_timedprev = pl;
+	}
+	poll_timed = pl;
+	pl->pl_timed = true;
+	spinlock_release(&poll_timerlock);
+}
+
+/*
+ * Take PL off poll_timed. Call with poll_timerlock held.
+ */
+static
+void
+poller_untime(struct poller *pl)
+{
+	KASSERT(spinlock_do_i_hold(&poll_timerlock));
+	KASSERT(pl->pl_timed);
+
+	if (pl->pl_timedprev != NULL) {
+		pl->pl_timedprev->pl_timednext = pl->pl_timednext;
+	}
+	else {
+		poll_timed = pl->pl_timednext;
+	}
+	if (pl->pl_timednext != NULL) {
+		pl->pl_timednext->pl_timedprev = pl->pl_timedprev;
+	}
+	pl->pl_timed = false;
+}
+
+void
+poller_destroy(struct poller *pl)
+{
+	unsigned i;
+
+	/*
+	 * Even if we're not on poll_timed, hardclock might be in the
+	 * middle of taking us off; wait for it to be done with us.
+	 */
+	spinlock_acquire(&poll_timerlock);
+	if (pl->pl_timed) {
+		poller_untime(pl);
+	}
+	spinlock_release(&poll_timerlock);
+
+	for (i = 0; i < pl->pl_nents; i++) {
+		if (pl->pl_ents[i].pe_head != NULL) {
+			pollhead_remove(&pl->pl_ents[i]);
+		}
+	}
+	wchan_destroy(pl->pl_wchan);
+	spinlock_cleanup(&pl->pl_lock);
+	kfree(pl->pl_ents);
+	kfree(pl);
+}
+
+void
+poller_settimeout(struct poller *pl, int timeout_ms)
+{
+	KASSERT(!pl->pl_timed);
+
+	if (timeout_ms > 0) {
+		poller_settimer(pl, timeout_ms);
+	}
+	else if (timeout_ms == 0) {
+		spinlock_acquire(&pl->pl_lock);
+		pl->pl_timedout = true;
+		spinlock_release(&pl->pl_lock);
+	}
+}
+
+int
+poller_wait(struct poller *pl)
+{
+	int result;
+
+	spinlock_acquire(&pl->pl_lock);
+	while (pl->pl_ready == NULL && !pl->pl_timedout) {
+		pl->pl_sleeping = true;
+		wchan_lock(pl->pl_wchan);
+		spinlock_release(&pl->pl_lock);
+		wchan_sleep(pl->pl_wchan);
+		spinlock_acquire(&pl->pl_lock);
+		pl->pl_sleeping = false;
+	}
+	result = pl->pl_ready != NULL ? 0 : ETIMEDOUT;
+	spinlock_release(&pl->pl_lock);
+	return result;
+}
+
+bool
+poller_next(struct poller *pl, unsigned *index)
+{
+	struct pollent *pe;
+
+	spinlock_acquire(&pl->pl_lock);
+	pe = pl->pl_ready;
+	if (pe != NULL) {
+		pl->pl_ready = pe->pe_readynext;
+		pe->pe_fired = false;
+	}
+	spinlock_release(&pl->pl_lock);
+
+	if (pe == NULL) {
+		return false;
+	}
+	*index = pe->pe_index;
+	return true;
+}
+
+void
+poll_hardclock(void)
+{
+	struct poller *pl, *next;
+	time_t secs;
+	uint32_t nsecs;
+
+	/* unlocked; if we miss one it'll be there next tick */
+	if (poll_timed == NULL) {
+		return;
+	}
+
+	gettime(&secs, &nsecs);
+
+	spinlock_acquire(&poll_timerlock);
+	for (pl = poll_timed; pl != NULL; pl = next) {
+		next = pl->pl_timednext;
+		if (pl->pl_secs < secs ||
+		    (pl->pl_secs == secs && pl->pl_nsecs <= nsecs)) {
+			poller_untime(pl);
+			poller_timeout(pl);
+		}
+	}
+	spinlock_release(&poll_timerlock);
+}
+
+////////////////////////////////////////////////////////////
+// vop_poll for plain files
+
+/*
+ * Reading or writing a file may wait for the disk, but it never waits
+ * for anyone else, so files are always ready.
+ */
+int
+vopnull_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	(void)v;
+	(void)pe;
+	*revents = events & (POLLIN | POLLOUT);
+	return 0;
+}
@@ -30,6 +30,9 @@
 /*
  * Basic vnode support functions.
  */
+
+#define VNODEINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -53,6 +56,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_opencount = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+
+	spinlock_init(&vn->vn_writelock);
+	vn->vn_writegen = 0;
 	return 0;
 }
 
@@ -71,9 +77,28 @@ vnode_cleanup(struct vnode *vn)
 	vn->vn_opencount = 0;
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
+	spinlock_cleanup(&vn->vn_writelock);
 }
 
 
+/*
+ * A write or truncate of VN has just finished.
+ * Called by VOP_WRITE and VOP_TRUNCATE.
+ *
+ * This is bumped afterwards, so that anyone who reads vn_writegen
+ * and then the file either sees the new contents or gets told to
+ * look again. The lock is so concurrent writers don't lose bumps;
+ * readers just load it.
+ */
+int
+vnode_written(struct vnode *vn, int result)
+{
+	spinlock_acquire(&vn->vn_writelock);
+	vn->vn_writegen++;
+	spinlock_release(&vn->vn_writelock);
+	return result;
+}
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
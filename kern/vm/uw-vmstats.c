@@ -5,7 +5,8 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by holding stats_lock
+ * for writing (seqlock_write_begin).
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
  */
@@ -14,12 +15,20 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <seqlock.h>
 #include <uw-vmstats.h>
 
 /* Counters for tracking statistics */
 static unsigned int stats_counts[VMSTAT_COUNT];
 
-struct spinlock stats_lock = SPINLOCK_INITIALIZER;
+/*
+ * The counters are bumped on every TLB fault, and read only when
+ * someone asks for the stats, which wants a consistent set of them.
+ * A seqlock keeps that read from costing the fault path anything
+ * beyond the writer's own lock; readers retry if a fault lands
+ * mid-snapshot.
+ */
+struct seqlock stats_lock = SEQLOCK_INITIALIZER;
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -41,23 +50,39 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    seqlock_write_begin(&stats_lock);
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    seqlock_write_end(&stats_lock);
 }
 
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
 {
-  /* Although the spinlock is initialized at declaration time we do it here
+  /* Although the seqlock is initialized at declaration time we do it here
    * again in case we want use/reset these stats repeatedly without shutting down the kernel.
    */
-  spinlock_init(&stats_lock);
+  seqlock_init(&stats_lock);
 
-  spinlock_acquire(&stats_lock);
+  seqlock_write_begin(&stats_lock);
     _vmstats_init();
-  spinlock_release(&stats_lock);
+  seqlock_write_end(&stats_lock);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Copy all of the counters into counts, as one consistent set, without locking */
+void
+vmstats_snapshot(unsigned int counts[VMSTAT_COUNT])
+{
+  unsigned seq;
+  int i;
+
+  do {
+    seq = seqlock_read_begin(&stats_lock);
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      counts[i] = stats_counts[i];
+    }
+  } while (seqlock_read_retry(&stats_lock, seq));
 }
 
 /* ---------------------------------------------------------------------- */
@@ -88,14 +113,15 @@ _vmstats_init(void)
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
- * Just use this when there is only one thread remaining.
+/* NOTE: We can't hold stats_lock here because kprintf may block.
+ * Instead print from a snapshot, which is consistent even if other
+ * threads are still running (it just won't include their later updates).
  */
 
 void
 vmstats_print(void)
 {
+  unsigned int counts[VMSTAT_COUNT];
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
@@ -103,17 +129,19 @@ vmstats_print(void)
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
 
+  vmstats_snapshot(counts);
+
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], counts[i]);
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = counts[VMSTAT_TLB_FAULT];
+  free_plus_replace = counts[VMSTAT_TLB_FAULT_FREE] + counts[VMSTAT_TLB_FAULT_REPLACE];
+  disk_plus_zeroed_plus_reload = counts[VMSTAT_PAGE_FAULT_DISK] +
+    counts[VMSTAT_PAGE_FAULT_ZERO] + counts[VMSTAT_TLB_RELOAD];
+  elf_plus_swap_reads = counts[VMSTAT_ELF_FILE_READ] + counts[VMSTAT_SWAP_FILE_READ];
+  disk_reads = counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -29,6 +29,7 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -38,13 +39,144 @@
 
 
 
+/*
+ * Files are read BATCH blocks at a time, with one ioring_enter for
+ * the reads and one for the writes, instead of a trap per block.
+ */
+#define BATCH 8
+
+static char bufs[BATCH][1024];
+static struct ioring ring;
+
+/* Write all of BUF, however many tries it takes. */
+static
+void
+writeall(const char *buf, int len)
+{
+	int wr, wrtot;
+
+	wrtot = 0;
+	while (wrtot < len) {
+		wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
+		if (wr<0) {
+			err(1, "stdout");
+		}
+		wrtot += wr;
+	}
+}
+
+/* Queue up a read or write on the ring. */
+static
+void
+post(int op, int flags, int fd, void *buf, int len)
+{
+	struct ioring_sqe *sqe;
+
+	sqe = &ring.ir_sq[ring.ir_sqtail % IORING_ENTRIES];
+	sqe->sqe_op = op;
+	sqe->sqe_flags = flags;
+	sqe->sqe_fd = fd;
+	sqe->sqe_buf = buf;
+	sqe->sqe_len = len;
+	ring.ir_sqtail++;
+}
+
+/* Run what's queued, up to the first entry that stops the batch. */
+static
+void
+enter(const char *name)
+{
+	if (ioring_enter(&ring, ring.ir_sqtail - ring.ir_sqhead) < 0) {
+		err(1, "%s", name);
+	}
+}
+
+/* Run everything queued. */
+static
+void
+submit(const char *name)
+{
+	while (ring.ir_sqhead != ring.ir_sqtail) {
+		enter(name);
+	}
+}
+
+/* Take the next completion; fail if it's an error. */
+static
+int
+reap(const char *name)
+{
+	struct ioring_cqe *cqe;
+
+	cqe = &ring.ir_cq[ring.ir_cqhead % IORING_ENTRIES];
+	ring.ir_cqhead++;
+	if (cqe->cqe_errno) {
+		errno = cqe->cqe_errno;
+		err(1, "%s", name);
+	}
+	return cqe->cqe_result;
+}
+
+/*
+ * Print a file, which can seek and so won't make us wait for more
+ * input than is there: a read past the end just returns 0.
+ */
+static
+void
+docat_batched(const char *name, int fd)
+{
+	int lens[BATCH];
+	int i, nwrites, wr, eof = 0;
+
+	while (!eof) {
+		for (i=0; i<BATCH; i++) {
+			post(IORING_OP_READ, 0, fd, bufs[i], sizeof(bufs[i]));
+		}
+		submit(name);
+
+		/* the reads ran in order, so the data comes in order */
+		nwrites = 0;
+		for (i=0; i<BATCH; i++) {
+			lens[i] = reap(name);
+			if (lens[i] == 0) {
+				eof = 1;
+			}
+			else if (!eof) {
+				post(IORING_OP_WRITE, IORING_F_STOP,
+				     STDOUT_FILENO, bufs[i], lens[i]);
+				nwrites++;
+			}
+		}
+
+		/*
+		 * A short write stops the batch, so we can finish it
+		 * before the writes queued behind it run; otherwise the
+		 * output would come out of order.
+		 */
+		for (i=0; i<nwrites; i++) {
+			if (ring.ir_cqhead == ring.ir_cqtail) {
+				enter("stdout");
+			}
+			wr = reap("stdout");
+			if (wr < lens[i]) {
+				writeall(bufs[i] + wr, lens[i] - wr);
+			}
+		}
+	}
+}
+
 /* Print a file that's already been opened. */
 static
 void
 docat(const char *name, int fd)
 {
 	char buf[1024];
-	int len, wr, wrtot;
+	int len;
+
+	if (lseek(fd, 0, SEEK_CUR) >= 0) {
+		docat_batched(name, fd);
+		return;
+	}
 
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
@@ -57,14 +189,7 @@ docat(const char *name, int fd)
 		 * Likewise, we may actually write less than we attempted
 		 * to. So loop until we're done.
 		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
-		}
+		writeall(buf, len);
 	}
 	/*
 	 * If we got a read error, print it and exit.
@@ -69,18 +69,21 @@ static int timing = 0;
 #define MAXBG 128
 static pid_t bgpids[MAXBG];
 
+/* most commands in one pipeline */
+#define MAXSTAGES 16
+
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for N open slots.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 	
 	for (i = 0; i < MAXBG; i++) {
-		if (bgpids[i] == 0) {
+		if (bgpids[i] == 0 && --n == 0) {
 			return 1;
 		}
 	}
@@ -277,6 +280,113 @@ cmd_exit(int ac, char *av[])
 	return 0; /* quell the compiler warning */
 }
 
+/*
+ * startstage
+ * starts one command of a pipeline with IN as its standard input and
+ * OUT as its standard output. OTHER, if not -1, is the read end of
+ * the pipe OUT writes to; the child mustn't hold that open, or it
+ * would never find out that the next command has gone away. returns
+ * the pid, or -1.
+ */
+static
+pid_t
+startstage(char **args, int in, int out, int other)
+{
+	pid_t pid;
+
+#ifdef HOST
+	pid = fork();
+#else
+	/* the child only shuffles descriptors and calls execv */
+	pid = vfork();
+#endif
+	if (pid < 0) {
+		warn("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		if (in != STDIN_FILENO) {
+			dup2(in, STDIN_FILENO);
+			close(in);
+		}
+		if (out != STDOUT_FILENO) {
+			dup2(out, STDOUT_FILENO);
+			close(out);
+		}
+		if (other >= 0) {
+			close(other);
+		}
+		execv(args[0], args);
+		warn("%s", args[0]);
+		/* _exit, not exit; see docommand */
+		_exit(1);
+	}
+	return pid;
+}
+
+/*
+ * dopipeline
+ * runs the NSTAGES commands in STAGES with each one's output piped to
+ * the next one's input. the shell closes its copies of the pipes as
+ * it goes, so each pipe ends up held only by the two commands it
+ * joins. in the foreground, waits for all of them and returns the
+ * status of the last one.
+ */
+static
+int
+dopipeline(char **stages[], int nstages, int bg)
+{
+	pid_t pids[MAXSTAGES];
+	int fds[2];
+	int in, n, i, status;
+
+	in = STDIN_FILENO;
+	for (n = 0; n < nstages; n++) {
+		if (n < nstages - 1) {
+			if (pipe(fds) < 0) {
+				warn("pipe");
+				break;
+			}
+		}
+		else {
+			fds[0] = -1;
+			fds[1] = STDOUT_FILENO;
+		}
+		pids[n] = startstage(stages[n], in, fds[1], fds[0]);
+		if (in != STDIN_FILENO) {
+			close(in);
+		}
+		if (fds[1] != STDOUT_FILENO) {
+			close(fds[1]);
+		}
+		in = fds[0];
+		if (pids[n] < 0) {
+			break;
+		}
+	}
+	if (n < nstages && in >= 0 && in != STDIN_FILENO) {
+		/* the commands already going see the pipe break */
+		close(in);
+	}
+
+	if (bg) {
+		for (i = 0; i < n; i++) {
+			remember_bg(pids[i]);
+			printf("[%d] %s ... &\n", pids[i], stages[i][0]);
+		}
+		return n < nstages ? _MKWAIT_EXIT(255) : 0;
+	}
+
+	status = 0;
+	for (i = 0; i < n; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			status = -1;
+		}
+	}
+	return n < nstages ? _MKWAIT_EXIT(255) : status;
+}
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -297,14 +407,16 @@ static struct {
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it. commands
+ * separated by "|" are run as a pipeline.
  */
 static
 int
 docommand(char *buf)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[MAXSTAGES];
+	int nargs, nstages, i;
 	char *s;
 	pid_t pid;
 	int status;
@@ -339,21 +451,52 @@ docommand(char *buf)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			return -1;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	/* split into pipeline stages at each "|" */
+	stages[0] = args;
+	nstages = 1;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|")) {
+			continue;
+		}
+		if (nstages >= MAXSTAGES) {
+			printf("%s: Too many commands in pipeline\n", args[0]);
+			return -1;
+		}
+		args[i] = NULL;
+		stages[nstages++] = &args[i+1];
+	}
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("sh: Missing command in pipeline\n");
+			return -1;
+		}
+	}
+
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		return -1;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
+	if (nstages > 1) {
+		status = dopipeline(stages, nstages, bg);
+		if (bg) {
+			return status;
+		}
+		goto done;
+	}
+
+#ifdef HOST
 	pid = fork();
 	switch (pid) {
 		case -1:
@@ -375,6 +518,17 @@ docommand(char *buf)
 		default:
 			break;
 	}
+#else
+	/*
+	 * Start the program directly, without copying the shell's
+	 * address space only to throw it away again in execv.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
+	}
+#endif
 
 	/* parent */
 	if (bg) {
@@ -389,6 +543,7 @@ docommand(char *buf)
 		status = -1;
 	}
 
+ done:
 	if (timing) {
 		__time(&endsecs, &endnsecs);
 		if (endnsecs < startnsecs) {
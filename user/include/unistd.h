@@ -39,6 +39,9 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/ioring.h>
+#include <kern/iovec.h>
+#include <kern/poll.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
@@ -152,16 +155,40 @@ int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+int preadv(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+int pwritev(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+int poll(struct pollfd *fds, unsigned nfds, int timeout);
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+	   struct timeval *timeout);
+struct rusage;
+pid_t wait4(pid_t pid, int *returncode, int flags, struct rusage *usage);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
+/* Process creation shortcuts. */
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args);	/* OS/161-specific */
+
+/* Batched system calls (OS/161-specific). */
+int ioring_enter(struct ioring *ring, unsigned tosubmit);
+
+/* User-level threads (OS/161-specific). */
+int __threadfork(void (*entry)(void *), void *arg);
+int threadjoin(int tid, int *status);
+__DEAD void threadexit(int status);
+
 /*
  * These are not themselves system calls, but wrapper routines in libc.
  */
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void));		/* calls __threadfork */
 
 #endif /* _UNISTD_H_ */
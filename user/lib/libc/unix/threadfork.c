@@ -0,0 +1,26 @@
+/*
+ * threadfork: start a new user-level thread running FUNC in this
+ * process. Returns the new thread's id, or -1 on error.
+ *
+ * The system call __threadfork starts the thread at an entry point
+ * with one argument and no return address, so go through a wrapper
+ * that calls FUNC and exits the thread when FUNC returns.
+ */
+
+#include <unistd.h>
+
+static
+void
+threadstart(void *arg)
+{
+	void (*func)(void) = (void (*)(void))arg;
+
+	func();
+	threadexit(0);
+}
+
+int
+threadfork(void (*func)(void))
+{
+	return __threadfork(threadstart, (void *)func);
+}
@@ -0,0 +1,190 @@
+/*
+ * pipebench - pipe throughput and latency.
+ *
+ * Usage: pipebench [megabytes [roundtrips [blocksize]]]
+ *
+ * First forks a child that reads and throws away everything that
+ * comes down a pipe, writes MEGABYTES (default 4) to it in writes of
+ * BLOCKSIZE bytes (default 4096), and prints the rate.
+ *
+ * Then forks a child that echoes back each byte it gets on one pipe
+ * on another, bounces ROUNDTRIPS (default 1000) single bytes off it,
+ * and prints the average round trip time. Each round trip is two
+ * writes, two reads and two context switches.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define DEFAULT_MBYTES		4
+#define DEFAULT_ROUNDTRIPS	1000
+#define DEFAULT_BLOCKSIZE	4096
+#define MAX_BLOCKSIZE		65536
+
+static char buf[MAX_BLOCKSIZE];
+
+/*
+ * Microseconds since START.
+ */
+static
+unsigned long
+elapsed_usecs(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long usecs;
+
+	__time(&secs, &nsecs);
+	usecs = (secs - startsecs) * 1000000;
+	if (nsecs < startnsecs) {
+		usecs -= (startnsecs - nsecs) / 1000;
+	}
+	else {
+		usecs += (nsecs - startnsecs) / 1000;
+	}
+	return usecs == 0 ? 1 : usecs;
+}
+
+static
+void
+reap(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", what);
+	}
+	if (status != 0) {
+		errx(1, "%s: child exited with status %d", what, status);
+	}
+}
+
+static
+void
+throughput(int mbytes, int blocksize)
+{
+	time_t startsecs;
+	unsigned long startnsecs, usecs, msecs, kbytes, rate;
+	unsigned long total, done;
+	int fds[2];
+	pid_t pid;
+	int r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[1]);
+		while ((r = read(fds[0], buf, blocksize)) > 0) {
+			/* nothing */
+		}
+		_exit(r < 0 ? 1 : 0);
+	}
+	close(fds[0]);
+
+	total = (unsigned long)mbytes * 1024 * 1024;
+	__time(&startsecs, &startnsecs);
+	for (done = 0; done < total; done += r) {
+		r = write(fds[1], buf, blocksize);
+		if (r <= 0) {
+			err(1, "write");
+		}
+	}
+	close(fds[1]);
+	reap(pid, "throughput");
+	usecs = elapsed_usecs(startsecs, startnsecs);
+
+	/* hundredths of a MB/s: kbytes / 1024 * 100 * 1000 / msecs */
+	kbytes = total / 1024;
+	msecs = usecs < 1000 ? 1 : usecs / 1000;
+	rate = kbytes * 3125 / 32 / msecs;
+	printf("throughput: %d MB in %d-byte writes in %lu.%03lu seconds, "
+	       "%lu.%02lu MB/s\n", mbytes, blocksize,
+	       usecs / 1000000, usecs / 1000 % 1000,
+	       rate / 100, rate % 100);
+}
+
+static
+void
+latency(int roundtrips)
+{
+	time_t startsecs;
+	unsigned long startnsecs, usecs;
+	int ping[2], pong[2];
+	char c = 'x';
+	pid_t pid;
+	int i;
+
+	if (pipe(ping) < 0 || pipe(pong) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(ping[1]);
+		close(pong[0]);
+		while (read(ping[0], &c, 1) == 1) {
+			if (write(pong[1], &c, 1) != 1) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	close(ping[0]);
+	close(pong[1]);
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<roundtrips; i++) {
+		if (write(ping[1], &c, 1) != 1) {
+			err(1, "write");
+		}
+		if (read(pong[0], &c, 1) != 1) {
+			errx(1, "read: lost the echo");
+		}
+	}
+	usecs = elapsed_usecs(startsecs, startnsecs);
+	close(ping[1]);
+	close(pong[0]);
+	reap(pid, "latency");
+
+	printf("latency: %d round trips in %lu.%03lu seconds, "
+	       "%lu.%03lu ms each\n", roundtrips,
+	       usecs / 1000000, usecs / 1000 % 1000,
+	       usecs / roundtrips / 1000, usecs / roundtrips % 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int mbytes = DEFAULT_MBYTES;
+	int roundtrips = DEFAULT_ROUNDTRIPS;
+	int blocksize = DEFAULT_BLOCKSIZE;
+
+	if (argc > 1) {
+		mbytes = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		roundtrips = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		blocksize = atoi(argv[3]);
+	}
+	if (argc > 4 || mbytes <= 0 || roundtrips <= 0 ||
+	    blocksize <= 0 || blocksize > MAX_BLOCKSIZE) {
+		errx(1, "Usage: pipebench [megabytes [roundtrips "
+		     "[blocksize]]] (blocksize at most %d)", MAX_BLOCKSIZE);
+	}
+
+	throughput(mbytes, blocksize);
+	latency(roundtrips);
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * pollstress - event loop stress test for poll() and select().
+ *
+ * Usage: pollstress [writers [messages]]
+ *
+ * Forks WRITERS (default 16) children, each with a pipe of its own,
+ * that each send MESSAGES (default 500) numbered 8-byte records down
+ * it and exit. The parent runs one event loop over all the read ends,
+ * alternating between poll and select, and checks that every record
+ * from every child turns up, in order, and that each pipe reports
+ * POLLHUP (or is readable at EOF, for select) once its writer is gone.
+ *
+ * Before that it checks that a zero timeout doesn't wait, that a poll
+ * on a pipe nobody writes to times out after about as long as asked,
+ * and that a descriptor that isn't open gets POLLNVAL.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define DEFAULT_WRITERS		16
+#define DEFAULT_MESSAGES	500
+#define MAX_WRITERS		(FD_SETSIZE / 2 - 4)
+#define TIMEOUT_MS		200
+
+struct record {
+	int r_writer;
+	int r_seq;
+};
+
+struct stream {
+	int s_fd;			/* read end, or -1 once closed */
+	pid_t s_pid;
+	int s_nextseq;			/* what we expect next */
+	size_t s_have;			/* bytes of s_rec so far */
+	struct record s_rec;
+};
+
+static struct stream streams[MAX_WRITERS];
+static struct pollfd pfds[MAX_WRITERS];
+
+/*
+ * Milliseconds since START.
+ */
+static
+unsigned long
+elapsed_msecs(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		secs--;
+		nsecs += 1000000000;
+	}
+	return (secs - startsecs) * 1000 + (nsecs - startnsecs) / 1000000;
+}
+
+static
+void
+writer(int id, int fd, int messages)
+{
+	struct record rec;
+	int i;
+
+	rec.r_writer = id;
+	for (i=0; i<messages; i++) {
+		rec.r_seq = i;
+		if (write(fd, &rec, sizeof(rec)) != sizeof(rec)) {
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static
+void
+checktimeouts(void)
+{
+	time_t startsecs;
+	unsigned long startnsecs, msecs;
+	struct pollfd pfd;
+	struct timeval tv;
+	fd_set rfds;
+	int fds[2];
+	int r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	__time(&startsecs, &startnsecs);
+	r = poll(&pfd, 1, 0);
+	msecs = elapsed_msecs(startsecs, startnsecs);
+	if (r != 0 || pfd.revents != 0) {
+		errx(1, "poll with no timeout on an empty pipe returned %d "
+		     "(revents 0x%x)", r, pfd.revents);
+	}
+	if (msecs > TIMEOUT_MS / 2) {
+		errx(1, "poll with no timeout took %lu ms", msecs);
+	}
+
+	__time(&startsecs, &startnsecs);
+	r = poll(&pfd, 1, TIMEOUT_MS);
+	msecs = elapsed_msecs(startsecs, startnsecs);
+	if (r != 0) {
+		errx(1, "poll on an idle pipe returned %d", r);
+	}
+	if (msecs < TIMEOUT_MS - 20 || msecs > TIMEOUT_MS * 5) {
+		errx(1, "%d ms poll timeout took %lu ms", TIMEOUT_MS, msecs);
+	}
+	printf("pollstress: %d ms poll timeout took %lu ms\n",
+	       TIMEOUT_MS, msecs);
+
+	FD_ZERO(&rfds);
+	FD_SET(fds[0], &rfds);
+	tv.tv_sec = 0;
+	tv.tv_usec = TIMEOUT_MS * 1000;
+	__time(&startsecs, &startnsecs);
+	r = select(fds[0] + 1, &rfds, NULL, NULL, &tv);
+	msecs = elapsed_msecs(startsecs, startnsecs);
+	if (r != 0 || FD_ISSET(fds[0], &rfds)) {
+		errx(1, "select on an idle pipe returned %d", r);
+	}
+	if (msecs < TIMEOUT_MS - 20 || msecs > TIMEOUT_MS * 5) {
+		errx(1, "%d ms select timeout took %lu ms", TIMEOUT_MS, msecs);
+	}
+
+	/* the write end of an empty pipe is writable, right away */
+	pfd.fd = fds[1];
+	pfd.events = POLLOUT;
+	r = poll(&pfd, 1, -1);
+	if (r != 1 || pfd.revents != POLLOUT) {
+		errx(1, "poll on an empty pipe's write end returned %d "
+		     "(revents 0x%x)", r, pfd.revents);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, -1);
+	if (r != 1 || pfd.revents != POLLNVAL) {
+		errx(1, "poll on a closed descriptor returned %d "
+		     "(revents 0x%x)", r, pfd.revents);
+	}
+}
+
+/*
+ * Read what's there from stream S. Returns 1 at EOF, else 0.
+ */
+static
+int
+drain(struct stream *s, int id, int messages)
+{
+	char *p = (char *)&s->s_rec;
+	int r;
+
+	r = read(s->s_fd, p + s->s_have, sizeof(s->s_rec) - s->s_have);
+	if (r < 0) {
+		err(1, "writer %d: read", id);
+	}
+	if (r == 0) {
+		if (s->s_have != 0 || s->s_nextseq != messages) {
+			errx(1, "writer %d: EOF after %d records", id,
+			     s->s_nextseq);
+		}
+		return 1;
+	}
+	s->s_have += r;
+	if (s->s_have == sizeof(s->s_rec)) {
+		if (s->s_rec.r_writer != id ||
+		    s->s_rec.r_seq != s->s_nextseq) {
+			errx(1, "writer %d: got record %d from writer %d, "
+			     "expected record %d", id, s->s_rec.r_seq,
+			     s->s_rec.r_writer, s->s_nextseq);
+		}
+		s->s_nextseq++;
+		s->s_have = 0;
+	}
+	return 0;
+}
+
+/*
+ * Wait for some streams to be ready, with poll or with select, and
+ * return a mask in READY (1 for each that is).
+ */
+static
+int
+waitready(int nwriters, int usepoll, char *ready)
+{
+	fd_set rfds;
+	int i, n, maxfd, r;
+
+	if (usepoll) {
+		n = 0;
+		for (i=0; i<nwriters; i++) {
+			pfds[i].fd = streams[i].s_fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		r = poll(pfds, nwriters, -1);
+		if (r <= 0) {
+			err(1, "poll returned %d", r);
+		}
+		for (i=0; i<nwriters; i++) {
+			if (pfds[i].revents & POLLNVAL) {
+				errx(1, "poll: descriptor %d not open",
+				     pfds[i].fd);
+			}
+			ready[i] = (pfds[i].revents & (POLLIN|POLLHUP)) != 0;
+			n += ready[i];
+		}
+		if (n != r) {
+			errx(1, "poll returned %d but %d are ready", r, n);
+		}
+		return n;
+	}
+
+	FD_ZERO(&rfds);
+	maxfd = -1;
+	for (i=0; i<nwriters; i++) {
+		if (streams[i].s_fd >= 0) {
+			FD_SET(streams[i].s_fd, &rfds);
+			if (streams[i].s_fd > maxfd) {
+				maxfd = streams[i].s_fd;
+			}
+		}
+	}
+	r = select(maxfd + 1, &rfds, NULL, NULL, NULL);
+	if (r <= 0) {
+		err(1, "select returned %d", r);
+	}
+	n = 0;
+	for (i=0; i<nwriters; i++) {
+		ready[i] = streams[i].s_fd >= 0 &&
+			FD_ISSET(streams[i].s_fd, &rfds);
+		n += ready[i];
+	}
+	if (n != r) {
+		errx(1, "select returned %d but %d are ready", r, n);
+	}
+	return n;
+}
+
+static
+void
+eventloop(int nwriters, int messages)
+{
+	time_t startsecs;
+	unsigned long startnsecs, msecs;
+	char ready[MAX_WRITERS];
+	int fds[2];
+	int i, j, status, nopen, waits, events;
+
+	for (i=0; i<nwriters; i++) {
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		streams[i].s_pid = fork();
+		if (streams[i].s_pid < 0) {
+			err(1, "fork");
+		}
+		if (streams[i].s_pid == 0) {
+			close(fds[0]);
+			/* don't hold up the others' EOFs */
+			for (j=0; j<i; j++) {
+				close(streams[j].s_fd);
+			}
+			writer(i, fds[1], messages);
+		}
+		close(fds[1]);
+		streams[i].s_fd = fds[0];
+		streams[i].s_nextseq = 0;
+		streams[i].s_have = 0;
+	}
+
+	__time(&startsecs, &startnsecs);
+	nopen = nwriters;
+	waits = events = 0;
+	while (nopen > 0) {
+		events += waitready(nwriters, waits % 2 == 0, ready);
+		waits++;
+		for (i=0; i<nwriters; i++) {
+			if (!ready[i]) {
+				continue;
+			}
+			if (drain(&streams[i], i, messages)) {
+				close(streams[i].s_fd);
+				streams[i].s_fd = -1;
+				nopen--;
+			}
+		}
+	}
+	msecs = elapsed_msecs(startsecs, startnsecs);
+
+	for (i=0; i<nwriters; i++) {
+		if (waitpid(streams[i].s_pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (status != 0) {
+			errx(1, "writer %d exited with status %d", i, status);
+		}
+	}
+
+	printf("pollstress: %d writers, %d records each, in %lu ms\n",
+	       nwriters, messages, msecs);
+	printf("pollstress: %d waits, %d.%02d ready descriptors per wait\n",
+	       waits, events / waits, events * 100 / waits % 100);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nwriters = DEFAULT_WRITERS;
+	int messages = DEFAULT_MESSAGES;
+
+	if (argc > 1) {
+		nwriters = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		messages = atoi(argv[2]);
+	}
+	if (argc > 3 || nwriters <= 0 || nwriters > MAX_WRITERS ||
+	    messages < 0) {
+		errx(1, "Usage: pollstress [writers [messages]] "
+		     "(at most %d writers)", MAX_WRITERS);
+	}
+
+	checktimeouts();
+	eventloop(nwriters, messages);
+	printf("pollstress: passed\n");
+	return 0;
+}
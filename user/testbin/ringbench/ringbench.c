@@ -0,0 +1,247 @@
+/*
+ * ringbench - system calls one trap at a time versus batched.
+ *
+ * Usage: ringbench [calls [readsize]]
+ *
+ * Makes CALLS (default 8192) getpid calls, first as ordinary system
+ * calls and then in batches through ioring_enter, and prints the cost
+ * per call each way. Then writes a scratch file and reads it back in
+ * READSIZE-byte pieces (default 16), again both ways, and checks that
+ * both read the same bytes.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define DEFAULT_CALLS		8192
+#define DEFAULT_READSIZE	16
+#define FILESIZE		65536
+#define SCRATCH			"ringbench.tmp"
+
+static struct ioring ring;
+static char filebuf[FILESIZE];
+static char readbuf[FILESIZE];
+
+/*
+ * Microseconds since START.
+ */
+static
+unsigned long
+elapsed_usecs(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long usecs;
+
+	__time(&secs, &nsecs);
+	usecs = (secs - startsecs) * 1000000;
+	if (nsecs < startnsecs) {
+		usecs -= (startnsecs - nsecs) / 1000;
+	}
+	else {
+		usecs += (nsecs - startnsecs) / 1000;
+	}
+	return usecs == 0 ? 1 : usecs;
+}
+
+static
+void
+report(const char *what, int calls, unsigned long trapusecs,
+       unsigned long ringusecs)
+{
+	printf("%s: %d calls, %lu.%03lu us each trapped, "
+	       "%lu.%03lu us each batched\n", what, calls,
+	       trapusecs / calls, trapusecs * 1000 / calls % 1000,
+	       ringusecs / calls, ringusecs * 1000 / calls % 1000);
+}
+
+static
+void
+post(int op, int fd, void *buf, size_t len, off_t off, int whence)
+{
+	struct ioring_sqe *sqe;
+
+	sqe = &ring.ir_sq[ring.ir_sqtail % IORING_ENTRIES];
+	sqe->sqe_op = op;
+	sqe->sqe_flags = 0;
+	sqe->sqe_fd = fd;
+	sqe->sqe_buf = buf;
+	sqe->sqe_len = len;
+	sqe->sqe_off = off;
+	sqe->sqe_whence = whence;
+	sqe->sqe_data = ring.ir_sqtail;
+	ring.ir_sqtail++;
+}
+
+/*
+ * Run everything posted, and check that a completion turned up for
+ * each, in order.
+ */
+static
+void
+submit(void)
+{
+	unsigned first = ring.ir_cqtail;
+	int r;
+
+	while (ring.ir_sqhead != ring.ir_sqtail) {
+		r = ioring_enter(&ring, ring.ir_sqtail - ring.ir_sqhead);
+		if (r <= 0) {
+			err(1, "ioring_enter returned %d", r);
+		}
+	}
+	if (ring.ir_cqtail - first != ring.ir_sqtail - ring.ir_cqhead) {
+		errx(1, "ioring_enter: %u completions for %u submissions",
+		     ring.ir_cqtail - first, ring.ir_sqtail - ring.ir_cqhead);
+	}
+}
+
+static
+struct ioring_cqe *
+reap(void)
+{
+	struct ioring_cqe *cqe;
+
+	cqe = &ring.ir_cq[ring.ir_cqhead % IORING_ENTRIES];
+	if (cqe->cqe_data != ring.ir_cqhead) {
+		errx(1, "completion %u is for submission %u",
+		     ring.ir_cqhead, cqe->cqe_data);
+	}
+	ring.ir_cqhead++;
+	if (cqe->cqe_errno) {
+		errno = cqe->cqe_errno;
+		err(1, "ioring op");
+	}
+	return cqe;
+}
+
+static
+void
+getpids(int calls)
+{
+	time_t startsecs;
+	unsigned long startnsecs, trapusecs, ringusecs;
+	pid_t pid;
+	int i, j, n;
+
+	pid = getpid();
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<calls; i++) {
+		if (getpid() != pid) {
+			errx(1, "getpid changed");
+		}
+	}
+	trapusecs = elapsed_usecs(startsecs, startnsecs);
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<calls; i+=n) {
+		n = calls - i < IORING_ENTRIES ? calls - i : IORING_ENTRIES;
+		for (j=0; j<n; j++) {
+			post(IORING_OP_GETPID, 0, NULL, 0, 0, 0);
+		}
+		submit();
+		for (j=0; j<n; j++) {
+			if (reap()->cqe_result != pid) {
+				errx(1, "batched getpid gave the wrong pid");
+			}
+		}
+	}
+	ringusecs = elapsed_usecs(startsecs, startnsecs);
+
+	report("getpid", calls, trapusecs, ringusecs);
+}
+
+static
+void
+reads(int readsize)
+{
+	time_t startsecs;
+	unsigned long startnsecs, trapusecs, ringusecs;
+	int fd, i, j, n, calls, r;
+
+	for (i=0; i<FILESIZE; i++) {
+		filebuf[i] = i * 7 + i / 251;
+	}
+	fd = open(SCRATCH, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SCRATCH);
+	}
+	if (write(fd, filebuf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", SCRATCH);
+	}
+	calls = FILESIZE / readsize;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", SCRATCH);
+	}
+	memset(readbuf, 0, sizeof(readbuf));
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<calls; i++) {
+		r = read(fd, readbuf + i * readsize, readsize);
+		if (r != readsize) {
+			err(1, "%s: read returned %d", SCRATCH, r);
+		}
+	}
+	trapusecs = elapsed_usecs(startsecs, startnsecs);
+	if (memcmp(readbuf, filebuf, calls * readsize)) {
+		errx(1, "%s: read back the wrong data", SCRATCH);
+	}
+
+	/* the lseek goes in the first batch, ahead of the reads */
+	memset(readbuf, 0, sizeof(readbuf));
+	__time(&startsecs, &startnsecs);
+	post(IORING_OP_LSEEK, fd, NULL, 0, 0, SEEK_SET);
+	for (i=0; i<calls; i+=n) {
+		n = calls - i < IORING_ENTRIES - 1 ? calls - i
+			: IORING_ENTRIES - 1;
+		for (j=0; j<n; j++) {
+			post(IORING_OP_READ, fd, readbuf + (i + j) * readsize,
+			     readsize, 0, 0);
+		}
+		submit();
+		if (i == 0 && reap()->cqe_result != 0) {
+			errx(1, "%s: batched lseek went astray", SCRATCH);
+		}
+		for (j=0; j<n; j++) {
+			if (reap()->cqe_result != readsize) {
+				errx(1, "%s: batched read came up short",
+				     SCRATCH);
+			}
+		}
+	}
+	ringusecs = elapsed_usecs(startsecs, startnsecs);
+	if (memcmp(readbuf, filebuf, calls * readsize)) {
+		errx(1, "%s: batched reads got the wrong data", SCRATCH);
+	}
+
+	close(fd);
+	remove(SCRATCH);
+
+	report("read", calls, trapusecs, ringusecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int calls = DEFAULT_CALLS;
+	int readsize = DEFAULT_READSIZE;
+
+	if (argc > 1) {
+		calls = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		readsize = atoi(argv[2]);
+	}
+	if (argc > 3 || calls <= 0 || readsize <= 0 || readsize > FILESIZE) {
+		errx(1, "Usage: ringbench [calls [readsize]] "
+		     "(readsize at most %d)", FILESIZE);
+	}
+
+	getpids(calls);
+	reads(readsize);
+	return 0;
+}
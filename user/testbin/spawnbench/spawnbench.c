@@ -0,0 +1,153 @@
+/*
+ * spawnbench - compare ways of starting a program.
+ *
+ * Usage: spawnbench [-a nargs] [count [program]]
+ *
+ * Starts PROGRAM (default /bin/true) COUNT times (default 100) each
+ * way: fork then execv, vfork then execv, and spawn, waiting for each
+ * one to finish before starting the next, and prints how long that
+ * took and the launch rate. fork copies the whole address space only
+ * for execv to throw it away; the other two don't, so the bigger this
+ * program is, the bigger the gap should be.
+ *
+ * With -a, PROGRAM also gets NARGS extra arguments, to time argument
+ * passing at large argc. Use /testbin/argtest as PROGRAM (with a small
+ * COUNT) to check they arrive intact.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define DEFAULT_COUNT	100
+#define DEFAULT_PROG	"/bin/true"
+#define MAX_NARGS	2000
+
+/* Make the address space fork has to copy a realistic size. */
+static char ballast[64 * 1024];
+
+static const char *prog;
+static char *args[MAX_NARGS + 2];
+static char argstrs[MAX_NARGS][8];
+
+static
+pid_t
+launch_fork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execv(prog, args);
+		_exit(255);
+	}
+	return pid;
+}
+
+static
+pid_t
+launch_vfork(void)
+{
+	pid_t pid;
+
+	pid = vfork();
+	if (pid == 0) {
+		execv(prog, args);
+		_exit(255);
+	}
+	return pid;
+}
+
+static
+pid_t
+launch_spawn(void)
+{
+	return spawn(prog, args);
+}
+
+static
+void
+run(const char *name, pid_t (*launch)(void), int count)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned long msecs;
+	int i, status;
+	pid_t pid;
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<count; i++) {
+		pid = launch();
+		if (pid < 0) {
+			err(1, "%s", name);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "%s: waitpid", name);
+		}
+		if (status != 0) {
+			errx(1, "%s: %s exited with status %d",
+			     name, prog, status);
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	msecs = (endsecs - startsecs) * 1000;
+	if (endnsecs < startnsecs) {
+		msecs -= (startnsecs - endnsecs) / 1000000;
+	}
+	else {
+		msecs += (endnsecs - startnsecs) / 1000000;
+	}
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("%-12s %d launches in %lu.%03lu seconds, %lu per second\n",
+	       name, count, msecs / 1000, msecs % 1000,
+	       (unsigned long)count * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = DEFAULT_COUNT;
+	int nargs = 0;
+	int i;
+
+	prog = DEFAULT_PROG;
+	if (argc > 2 && !strcmp(argv[1], "-a")) {
+		nargs = atoi(argv[2]);
+		if (nargs < 0 || nargs > MAX_NARGS) {
+			errx(1, "-a: at most %d arguments", MAX_NARGS);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc > 1) {
+		count = atoi(argv[1]);
+		if (count <= 0) {
+			errx(1, "Usage: spawnbench [-a nargs] [count [program]]");
+		}
+	}
+	if (argc > 2) {
+		prog = argv[2];
+	}
+	args[0] = (char *)prog;
+	for (i=0; i<nargs; i++) {
+		snprintf(argstrs[i], sizeof(argstrs[i]), "a%d", i);
+		args[i+1] = argstrs[i];
+	}
+	args[nargs+1] = NULL;
+	if (nargs > 0) {
+		printf("Passing %d arguments\n", nargs);
+	}
+
+	/* touch it so it's really there to be copied */
+	ballast[0] = ballast[sizeof(ballast) - 1] = 1;
+
+	run("fork+execv", launch_fork, count);
+	run("vfork+execv", launch_vfork, count);
+	run("spawn", launch_spawn, count);
+	return 0;
+}
@@ -38,8 +38,10 @@
  * It also makes various assumptions about the thread API. In
  * particular, it believes (1) that you create a thread by calling
  * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
+ * thread to begin at, which returns a thread id that can be passed
+ * to "threadjoin()", (2) that exiting the process (as returning from
+ * main does) takes all of its threads with it, so the parent joins
+ * the children first, and (3) child threads will exit if they
  * return from the function they started in. If any or all of these
  * assumptions are not met by your user-level threads, you will need
  * to patch this test accordingly.
@@ -51,6 +53,7 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
 
 #define NTHREADS  3
 #define MAX       1<<25
@@ -68,15 +71,23 @@ int
 main(int argc, char *argv[])
 {
     int i;
+    int tids[NTHREADS];
 
     (void)argc;
     (void)argv;
 
     for (i=0; i<NTHREADS; i++) {
 	if (i)
-	    threadfork(ThreadRunner);
+	    tids[i] = threadfork(ThreadRunner);
         else
-	    threadfork(BladeRunner);
+	    tids[i] = threadfork(BladeRunner);
+	if (tids[i] < 0)
+	    err(1, "threadfork");
+    }
+
+    for (i=0; i<NTHREADS; i++) {
+	if (threadjoin(tids[i], NULL) < 0)
+	    err(1, "threadjoin");
     }
 
     printf("Parent has left.\n");